@@ -0,0 +1,180 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+// chunk index microbenchmark: make bench_chunk && ./bench_chunk
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jansson.h>
+
+#include "globals.h"
+#include "chunk.h"
+
+#define BENCH_MS0 0x18b0e3a0000ull // chunk names are ms since epoch
+#define BENCH_CHUNK_MSEC (STREAM_FRAMES * STREAM_FPS_MSEC)
+#define BENCH_LOOKUPS 1000000
+#define BENCH_DELTA 100 // chunks of one late delta merged in the middle
+#define BENCH_LISTING 24000 // chunks of /chunks response, about a day of one camera
+#define BENCH_LISTING_SRV 2
+#define BENCH_PARSES 20
+
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t bench_ms(uint32_t i)
+{
+    // chunk start with some jitter, sorted
+    return BENCH_MS0 + (uint64_t)i * BENCH_CHUNK_MSEC + (i * 7919u) % 97;
+}
+
+static void bench_merge_find(uint32_t n)
+{
+    chunk_index_t ci = {};
+    chunk_t ch[BENCH_DELTA];
+    uint64_t t, sum = 0;
+
+    // delta sync appends few chunks every second
+    t = bench_ns();
+    for (uint32_t i = 0; i < n; i++)
+    {
+        ch[0] = (chunk_t){.ms = bench_ms(2 * i)};
+        chunk_merge(&ci, ch, 1, 0, NULL);
+    }
+    t = bench_ns() - t;
+    printf("chunks %7u append merge %8.1f ns/chunk (%s)\n", n, (double)t / n, ci.slotlen ? "slots" : "bsearch");
+
+    // late chunks from other server, odd positions all over the index
+    for (uint32_t i = 0; i < BENCH_DELTA; i++)
+        ch[i] = (chunk_t){.ms = bench_ms(2 * (uint32_t)((uint64_t)i * n / BENCH_DELTA) + 1), .srvid = 1};
+    t = bench_ns();
+    chunk_merge(&ci, ch, BENCH_DELTA, 0, NULL);
+    t = bench_ns() - t;
+    A(ci.len == n + BENCH_DELTA);
+    printf("chunks %7u insert merge %8.1f us/delta of %d\n", n, t / 1000.0, BENCH_DELTA);
+
+    // random seek
+    uint64_t span = ci.ch[ci.len - 1].ms - ci.ch[0].ms;
+    uint32_t r = 1;
+    t = bench_ns();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        r = r * 1103515245 + 12345;
+        sum += chunk_find(&ci, ci.ch[0].ms + ((uint64_t)r << 16 | r >> 16) % span)->ms;
+    }
+    t = bench_ns() - t;
+    printf("chunks %7u find         %8.1f ns/lookup\n", n, (double)t / BENCH_LOOKUPS);
+
+    // playback, neighbour chunks
+    uint32_t cur = 0;
+    t = bench_ns();
+    for (uint32_t i = 0; i < ci.len; i++)
+        sum += chunk_cursor(&ci, &cur, ci.ch[i].ms)->ms;
+    t = bench_ns() - t;
+    printf("chunks %7u cursor       %8.1f ns/step\n", n, (double)t / ci.len);
+
+    if (!sum)
+        printf("\n");
+    chunk_free(&ci);
+}
+
+static char *bench_listing(size_t *len)
+{
+    // master /chunks response, chunks of each server sorted
+    size_t size = BENCH_LISTING * 20 + BENCH_LISTING_SRV * 32 + 3;
+    char *p, *b;
+
+    CAVNZ(b, malloc(size));
+    p = b;
+    *p++ = '[';
+    for (uint32_t s = 0; s < BENCH_LISTING_SRV; s++)
+    {
+        p += sprintf(p, "%s{\"srvid\":%u,\"ts\":[", s ? "," : "", s);
+        for (uint32_t i = s; i < BENCH_LISTING; i += BENCH_LISTING_SRV)
+            p += sprintf(p, "%s\"%lx\"", i == s ? "" : ",", bench_ms(i));
+        p += sprintf(p, "]}");
+    }
+    *p++ = ']';
+    *p = 0;
+    *len = p - b;
+    return b;
+}
+
+static void bench_listing_jansson(chunk_index_t *ci, const char *b, size_t len)
+{
+    // DOM parse as chunk_fetch did before chunk_parse
+    json_t *json;
+
+    CAVNZ(json, json_loadb(b, len, JSON_DECODE_ANY, NULL));
+    A(json_is_array(json));
+    for (int i = 0; i < json_array_size(json); i++)
+    {
+        json_int_t srvid = json_integer_value(json_object_get(json_array_get(json, i), "srvid"));
+
+        json_t *tss = json_object_get(json_array_get(json, i), "ts");
+        A(json_is_array(tss));
+        size_t n = json_array_size(tss);
+        chunk_reserve(ci, ci->len + n);
+        for (int j = 0; j < n; j++)
+        {
+            ci->ch[ci->len].ms = strtoull(json_string_value(json_array_get(tss, j)), NULL, 16);
+            ci->ch[ci->len].srvid = srvid;
+            ci->ch[ci->len].frames = 0;
+            ci->len++;
+        }
+    }
+    json_decref(json);
+}
+
+static void bench_parse(void)
+{
+    chunk_index_t ci = {}, cj = {};
+    size_t len;
+    char *b = bench_listing(&len);
+    uint64_t t, tj;
+
+    t = bench_ns();
+    for (int i = 0; i < BENCH_PARSES; i++)
+    {
+        ci.len = 0;
+        CA(chunk_parse(&ci, b, len), == true);
+    }
+    t = bench_ns() - t;
+
+    tj = bench_ns();
+    for (int i = 0; i < BENCH_PARSES; i++)
+    {
+        cj.len = 0;
+        bench_listing_jansson(&cj, b, len);
+    }
+    tj = bench_ns() - tj;
+
+    A(ci.len == BENCH_LISTING && cj.len == BENCH_LISTING);
+    for (uint32_t i = 0; i < ci.len; i++)
+        A(ci.ch[i].ms == cj.ch[i].ms && ci.ch[i].srvid == cj.ch[i].srvid);
+    printf("listing %u chunks %zu bytes: chunk_parse %.2f ms (%.0f MB/s), jansson %.2f ms (%.0f MB/s)\n", ci.len, len,
+           t / 1e6 / BENCH_PARSES, len * 1e3 * BENCH_PARSES / t, tj / 1e6 / BENCH_PARSES, len * 1e3 * BENCH_PARSES / tj);
+
+    chunk_free(&ci);
+    chunk_free(&cj);
+    free(b);
+}
+
+int main(int argc, char **argv)
+{
+    bench_merge_find(10000);
+    bench_merge_find(100000);
+    bench_merge_find(1000000);
+    bench_parse();
+    return 0;
+}
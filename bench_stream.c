@@ -0,0 +1,350 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+// stream internals microbenchmark on generated chunks, decode of generated or recorded one: make bench_stream && ./bench_stream [chunk.ts]
+
+#include <libavcodec/avcodec.h>
+
+// decoder entry points counted apart, allocations inside them belong to libavcodec
+static int bench_send_packet(AVCodecContext *ctx, const AVPacket *pkt);
+static int bench_receive_frame(AVCodecContext *ctx, AVFrame *frame);
+#define avcodec_send_packet bench_send_packet
+#define avcodec_receive_frame bench_receive_frame
+
+#define main jc_player_main
+#include "main.c"
+#undef main
+#undef avcodec_send_packet
+#undef avcodec_receive_frame
+
+#include "test_stream.h"
+
+#define BENCH_MS0 0x18b0e3a0000ull
+#define BENCH_KEY_BYTES 60000 // about 4 Mbit/s at gop 25
+#define BENCH_DEMUX_PASSES 200
+#define BENCH_PLAY_CHUNKS 1000
+#define BENCH_DECODE_PASSES 10
+#define BENCH_MB_WIDTH 20 // generated chunk 320x192
+#define BENCH_MB_HEIGHT 12
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+
+static bool bench_counting;
+static uint64_t bench_allocs, bench_alloc_bytes, bench_codec_allocs;
+static __thread bool bench_player; // thread running measured player code
+static __thread int bench_codec;   // inside decoder call
+
+// +++ ALLOCATIONS
+
+static inline void bench_alloc_count(size_t size)
+{
+    if (!__atomic_load_n(&bench_counting, __ATOMIC_RELAXED))
+        return;
+    if (bench_player && !bench_codec)
+    {
+        __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&bench_alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+    else
+        __atomic_add_fetch(&bench_codec_allocs, 1, __ATOMIC_RELAXED); // decoder, its threads and callbacks
+}
+
+void *malloc(size_t size)
+{
+    bench_alloc_count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    bench_alloc_count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    bench_alloc_count(size);
+    return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    bench_alloc_count(size);
+    return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    bench_alloc_count(size);
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+    bench_alloc_count(size);
+    *p = __libc_memalign(align, size);
+    return *p ? 0 : ENOMEM;
+}
+
+static int bench_send_packet(AVCodecContext *ctx, const AVPacket *pkt)
+{
+    bench_codec++;
+    int ret = avcodec_send_packet(ctx, pkt);
+    bench_codec--;
+    return ret;
+}
+
+static int bench_receive_frame(AVCodecContext *ctx, AVFrame *frame)
+{
+    bench_codec++;
+    int ret = avcodec_receive_frame(ctx, frame);
+    bench_codec--;
+    return ret;
+}
+
+static void bench_count(bool on)
+{
+    if (on)
+        bench_allocs = bench_alloc_bytes = bench_codec_allocs = 0;
+    __atomic_store_n(&bench_counting, on, __ATOMIC_RELAXED);
+}
+
+// +++ BENCH
+
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_demux(void)
+{
+    // whole chunk demuxed from memory as decoder does, copy of the same bytes for reference
+    static uint8_t b[TEST_TS_SIZE(STREAM_FRAMES, BENCH_KEY_BYTES)], c[sizeof(b)];
+    static decoder_t d;
+    AVPacket packet = {};
+    uint64_t t, tc, tg, payload = 0;
+    uint32_t packets = 0;
+
+    size_t len = test_ts_chunk(b, STREAM_FRAMES, 25, BENCH_KEY_BYTES, 0, false);
+
+    // packet kept between reads as decoder does, its buffer reused
+    t = bench_ns();
+    for (int i = 0; i < BENCH_DEMUX_PASSES; i++)
+    {
+        bd_t bd = {b, len, 0};
+        if (i == 1)
+            bench_count(true);
+        while (ts_read_packet(&bd, &packet) >= 0)
+        {
+            payload += packet.size;
+            packets++;
+        }
+    }
+    bench_count(false);
+    t = bench_ns() - t;
+    av_packet_unref(&packet);
+    A(packets == STREAM_FRAMES * BENCH_DEMUX_PASSES);
+    uint64_t allocs = bench_allocs;
+
+    tc = bench_ns();
+    for (int i = 0; i < BENCH_DEMUX_PASSES; i++)
+    {
+        memcpy(c, b, len);
+        __asm__ volatile("" : : "r"(c) : "memory");
+    }
+    tc = bench_ns() - tc;
+
+    // keyframe index build, new chunk every pass
+    d.map = (bd_t){b, len, 0};
+    tg = bench_ns();
+    for (int i = 0; i < BENCH_DEMUX_PASSES; i++)
+        A(stream_gop(&d, BENCH_MS0 + i)->frames == STREAM_FRAMES);
+    tg = bench_ns() - tg;
+
+    printf("demux chunk %zu bytes %u frames: ts_read_packet %.0f MB/s %.0f ns/packet %.2f allocations/packet (payload %.0f%%), memcpy %.0f MB/s, stream_gop %.1f us/chunk\n",
+           len, STREAM_FRAMES, len * 1e3 * BENCH_DEMUX_PASSES / t, (double)t / packets, (double)allocs / (packets - STREAM_FRAMES),
+           payload * 100.0 / len / BENCH_DEMUX_PASSES, len * 1e3 * BENCH_DEMUX_PASSES / tc, tg / 1e3 / BENCH_DEMUX_PASSES);
+    A(!allocs);
+}
+
+static void bench_frame_free(void *opaque, uint8_t *data)
+{
+}
+
+static AVBufferRef *bench_frame_alloc(void *opaque, size_t size)
+{
+    // every pool entry maps the same memory, frames are never read
+    swframe_t *sf = (swframe_t *)opaque;
+    return av_buffer_create(sf->map, sf->size, bench_frame_free, sf, 0);
+}
+
+static void bench_fill(AVBufferPool *pool, uint64_t ms, uint32_t id, int dir, uint32_t skip, uint32_t n)
+{
+    // decoded frames in decode order: forward in play order, reverse from earliest of block
+    uint64_t pms[FRAMES_PRELOAD];
+    uint32_t pid[FRAMES_PRELOAD], ck = 0, len = 0;
+
+    while (len < n)
+    {
+        pms[len] = ms, pid[len++] = id;
+        if (!stream_frame_step(&ck, &ms, &id, dir, skip))
+            break;
+    }
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint32_t j = dir > 0 ? i : len - 1 - i;
+        AVFrame *frame = stream_frame_shell();
+        CAVNZ(frame->buf[0], av_buffer_pool_get(pool));
+        if (!stream_add_frame(frame, pms[j], pid[j], 0))
+            stream_frame_release(&frame);
+    }
+}
+
+static void bench_play(int dir, uint32_t skip, AVBufferPool *pool)
+{
+    // decoder thread wakes per shown frame: playhead, eviction, refill below threshold up to free room, restart on miss
+    uint64_t ms = stream.chi.ch[dir > 0 ? 0 : stream.chi.len - 1].ms, t, adds = stream.frm_adds, evicts = stream.frm_evicts;
+    uint32_t id = dir > 0 ? 0 : ((STREAM_FRAMES - 1) / skip) * skip, ck = dir > 0 ? 0 : stream.chi.len - 1, shown = 0, misses = 0;
+
+    stream_frame_flush();
+    stream.frm_size = 0;
+    stream.speed = dir;
+    stream.show_skip = skip;
+    t = bench_ns();
+    do
+    {
+        stream.show_ms = ms, stream.show_id = id;
+        A(chunk_cursor(&stream.chi, &stream.frm_ck, ms));
+        if (!stream_has_frame(ms, id))
+        {
+            misses++;
+            stream_frame_flush();
+            bench_fill(pool, ms, id, dir, skip, FRAMES_PRELOAD);
+        }
+        stream_frame_head(ms, id, dir, skip);
+        stream_frame_evict();
+        if (1 + stream.frm_ahead < stream.frm_treshold && stream.frm_tail_ms)
+            bench_fill(pool, stream.frm_tail_ms, stream.frm_tail_id, dir, skip, FFMIN(FRAMES_PRELOAD, stream.frm_max - stream.frm_behind - 1 - stream.frm_ahead));
+        A(stream.frmlen <= stream.frm_max && stream_has_frame(ms, id));
+        shown++;
+    } while (stream_frame_step(&ck, &ms, &id, dir, skip));
+    t = bench_ns() - t;
+
+    printf("frame cache %s skip %u, %u frames max: %.0f ns/frame shown, %.2f adds %.2f evicts per frame, %u misses\n",
+           dir > 0 ? "forward" : "reverse", skip, stream.frm_max, (double)t / shown, (double)(stream.frm_adds - adds) / shown,
+           (double)(stream.frm_evicts - evicts) / shown, misses);
+}
+
+static void bench_frames(void)
+{
+    chunk_t ch;
+    swframe_t sf[3] = {{.size = 640 * 368 * 3 / 2}, {.size = 1920 * 1088 * 3 / 2}, {.size = 3840 * 2160 * 3 / 2}};
+
+    stream.swdec = true;
+    for (uint32_t i = 0; i < BENCH_PLAY_CHUNKS; i++)
+    {
+        ch = (chunk_t){.ms = BENCH_MS0 + i * STREAM_FRAMES * STREAM_FPS_MSEC, .frames = STREAM_FRAMES};
+        chunk_merge(&stream.chi, &ch, 1, 0, NULL);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        AVBufferPool *pool;
+        CAVNZ(pool, av_buffer_pool_init2(sf[i].size, sf + i, bench_frame_alloc, NULL));
+        bench_play(1, 1, pool);
+        bench_play(-1, 1, pool);
+        bench_play(1, 4, pool);
+        bench_play(-1, 4, pool);
+        stream_frame_flush();
+        av_buffer_pool_uninit(&pool);
+    }
+    chunk_free(&stream.chi);
+    stream.swdec = false;
+}
+
+static void bench_decode(const char *fn)
+{
+    // heap allocations of whole chunk decode into frame cache, first pass warms pools and caches
+    static uint8_t b[TEST_TS_SIZE(STREAM_FRAMES, TEST_H264_BYTES(BENCH_MB_WIDTH, BENCH_MB_HEIGHT))];
+    static decoder_t d;
+    uint64_t ms = BENCH_MS0, t = 0, adds = 0, codec = 0;
+    chunk_t ch = {.ms = ms};
+
+    if (fn)
+    {
+        avcodec_parameters_free(&stream.codecpar);
+        av_buffer_pool_uninit(&stream.decode_pool);
+        CAVZP(d.map_fd, open(fn, O_RDONLY));
+        CAVP(d.map.blen, lseek(d.map_fd, 0, SEEK_END));
+        CAV(d.map.b, mmap(NULL, d.map.blen, PROT_READ, MAP_PRIVATE, d.map_fd, 0), != MAP_FAILED);
+        stream_setup(d.map.b, d.map.blen);
+    }
+    else
+    {
+        // generated, software decode as no display is open
+        fn = "generated";
+        d.map = (bd_t){b, test_h264_chunk(b, STREAM_FRAMES, 25, BENCH_MB_WIDTH, BENCH_MB_HEIGHT), 0};
+        stream.codecpar->codec_id = AV_CODEC_ID_H264;
+        CAVNZ(stream.codec, avcodec_find_decoder(AV_CODEC_ID_H264));
+        stream.swdec = true;
+        CAZ(pthread_mutex_init(&stream.swdec_mutex, NULL));
+    }
+    d.map_ms = ms;
+    chunk_merge(&stream.chi, &ch, 1, 0, NULL);
+    stream_decoder_open(&d);
+    stream.stream_initialized = true;
+    stream.show_ms = ms, stream.show_id = 0, stream.speed = 1;
+
+    bench_player = true;
+    for (int i = 0; i <= BENCH_DECODE_PASSES; i++)
+    {
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        stream_frame_flush();
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        if (i == 1)
+        {
+            adds = stream.frm_adds;
+            t = bench_ns();
+            bench_count(true);
+        }
+        d.ms = 0; // restart from first frame
+        stream_decode(&d, ms, 0, STREAM_FRAMES_MAX, 1);
+    }
+    bench_count(false);
+    t = bench_ns() - t;
+    bench_player = false;
+    codec = bench_codec_allocs;
+
+    uint32_t frames = stream_gop(&d, ms)->frames;
+    printf("decode %s %u frames %s: %.2f allocations %.0f bytes per frame, libavcodec %.2f allocations per frame, %" PRIu64 " frames cached, %.0f fps\n",
+           fn, frames, stream.swdec ? "software" : "hardware", (double)bench_allocs / BENCH_DECODE_PASSES / frames,
+           (double)bench_alloc_bytes / BENCH_DECODE_PASSES / frames, (double)codec / BENCH_DECODE_PASSES / frames,
+           (stream.frm_adds - adds) / BENCH_DECODE_PASSES, frames * BENCH_DECODE_PASSES * 1e9 / t);
+    A(!bench_allocs); // demux, cache and frame shells of player allocate nothing per frame
+
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    stream_frame_flush();
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    avcodec_free_context(&d.ctx);
+    av_frame_free(&d.frame);
+    av_packet_unref(&d.packet);
+    if (d.map.b == b)
+        d.map_ms = 0; // not mapped
+    stream_unmap(&d);
+    chunk_free(&stream.chi);
+}
+
+int main(int argc, char **argv)
+{
+    test_stream_setup(AV_CODEC_ID_H264);
+    bench_demux();
+    bench_frames();
+    bench_decode(argc > 1 ? argv[1] : NULL);
+    return 0;
+}
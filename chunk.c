@@ -0,0 +1,397 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+
+#include "globals.h"
+#include "chunk.h"
+#include "chunk_watch.h"
+
+int compare_chunk(const void *a, const void *b)
+{
+    if (((const chunk_t *)a)->ms < ((const chunk_t *)b)->ms)
+        return -1;
+    if (((const chunk_t *)a)->ms > ((const chunk_t *)b)->ms)
+        return 1;
+    return 0;
+}
+
+void chunk_reserve(chunk_index_t *ci, uint32_t len)
+{
+    uint32_t size = ci->size ? ci->size : CHUNK_INDEX_MIN;
+
+    if (len <= ci->size)
+        return;
+    while (size < len)
+        size *= 2;
+    CAVNZ(ci->ch, realloc(ci->ch, sizeof(chunk_t) * size));
+    ci->size = size;
+}
+
+void chunk_free(chunk_index_t *ci)
+{
+    free(ci->ch);
+    free(ci->slot);
+    memset(ci, 0, sizeof(*ci));
+}
+
+static void chunk_slots_fill(chunk_index_t *ci, uint32_t k, uint32_t i)
+{
+    // slots from k on, chunk i is first at or after slot k
+    uint64_t slots = (ci->ch[ci->len - 1].ms - ci->slotbase) / CHUNK_SLOT_MSEC + 1;
+
+    ci->slotlen = 0;
+    if (slots > CHUNK_SLOT_MAX)
+        return;
+    if (slots > ci->slotsize)
+    {
+        uint32_t size = ci->slotsize ? ci->slotsize : slots;
+        while (size < slots)
+            size *= 2;
+        if (size > CHUNK_SLOT_MAX)
+            size = CHUNK_SLOT_MAX;
+        CAVNZ(ci->slot, realloc(ci->slot, sizeof(uint32_t) * size));
+        ci->slotsize = size;
+    }
+    for (; k < slots; k++)
+    {
+        while (ci->ch[i].ms < ci->slotbase + (uint64_t)k * CHUNK_SLOT_MSEC)
+            i++;
+        ci->slot[k] = i;
+    }
+    ci->slotlen = slots;
+}
+
+void chunk_slots(chunk_index_t *ci)
+{
+    // rebuild time slot table after index change
+    ci->slotlen = 0;
+    if (!ci->len)
+        return;
+    ci->slotbase = ci->ch[0].ms / CHUNK_SLOT_MSEC * CHUNK_SLOT_MSEC;
+    chunk_slots_fill(ci, 0, 0);
+}
+
+void chunk_slots_append(chunk_index_t *ci, uint32_t from)
+{
+    // chunks from index from appended after previous last, slots before stay
+    if (!ci->slotlen || !from)
+        chunk_slots(ci);
+    else
+        chunk_slots_fill(ci, ci->slotlen, from);
+}
+
+chunk_t *chunk_find(chunk_index_t *ci, uint64_t ms)
+{
+    // last chunk starting at or before ms, first chunk if ms is before index
+    uint32_t l, r;
+
+    if (!ci->len)
+        return NULL;
+    if (ms < ci->ch[0].ms)
+        return ci->ch;
+    if (ci->slotlen)
+    {
+        uint64_t k = (ms - ci->slotbase) / CHUNK_SLOT_MSEC;
+        if (k >= ci->slotlen)
+            return ci->ch + ci->len - 1;
+        // chunks are longer than slot, at most few steps
+        for (l = ci->slot[k]; l < ci->len && ci->ch[l].ms <= ms; l++)
+            ;
+        return ci->ch + l - 1;
+    }
+    for (l = 0, r = ci->len; l < r;)
+    {
+        uint32_t m = l + (r - l) / 2;
+        if (ci->ch[m].ms <= ms)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return ci->ch + l - 1;
+}
+
+chunk_t *chunk_get(chunk_index_t *ci, uint64_t ms)
+{
+    chunk_t *ck = chunk_find(ci, ms);
+    return ck && ck->ms == ms ? ck : NULL;
+}
+
+chunk_t *chunk_cursor(chunk_index_t *ci, uint32_t *cur, uint64_t ms)
+{
+    // follow playback position, lookup only after seek or index change
+    if (*cur < ci->len && ci->ch[*cur].ms == ms)
+        return ci->ch + *cur;
+    if (*cur + 1 < ci->len && ci->ch[*cur + 1].ms == ms)
+        return ci->ch + ++*cur;
+    if (*cur && *cur - 1 < ci->len && ci->ch[*cur - 1].ms == ms)
+        return ci->ch + --*cur;
+    chunk_t *ck = chunk_get(ci, ms);
+    if (ck)
+        *cur = ck - ci->ch;
+    return ck;
+}
+
+void chunk_merge(chunk_index_t *ci, chunk_t *src, uint32_t srclen, uint64_t cursor, bool *mismatch)
+{
+    // src sorted and reused as scratch
+    uint32_t i, j, n = 0;
+
+    for (i = 0; i < srclen; i++)
+    {
+        if (ci->len && src[i].ms <= ci->ch[ci->len - 1].ms)
+        {
+            if (chunk_get(ci, src[i].ms))
+                continue; // already known
+            if (mismatch && src[i].ms < cursor)
+                *mismatch = true; // new chunk behind the cursor
+        }
+        src[n++] = src[i];
+    }
+    if (!n)
+        return;
+    chunk_reserve(ci, ci->len + n);
+
+    // merge from the end, usually only append
+    bool append = !ci->len || src[0].ms > ci->ch[ci->len - 1].ms;
+    uint32_t from = ci->len;
+    for (i = ci->len, j = n; j;)
+    {
+        if (i && ci->ch[i - 1].ms > src[j - 1].ms)
+        {
+            ci->ch[i + j - 1] = ci->ch[i - 1];
+            i--;
+        }
+        else
+        {
+            ci->ch[i + j - 1] = src[j - 1];
+            j--;
+        }
+    }
+    ci->len += n;
+    if (append)
+        chunk_slots_append(ci, from);
+    else
+        chunk_slots(ci);
+}
+
+uint32_t chunk_id(chunk_index_t *ci, chunk_t *ck, uint64_t msec)
+{
+    // frame at time, chunk duration from next chunk unless there is a gap
+    uint32_t frames = chunk_frames(ck);
+    uint64_t dur = frames * STREAM_FPS_MSEC;
+    if (ck + 1 < ci->ch + ci->len && ck[1].ms > ck->ms && ck[1].ms - ck->ms < dur * 3 / 2)
+        dur = ck[1].ms - ck->ms;
+    if (msec < ck->ms || msec - ck->ms > dur)
+        return 0;
+    uint32_t id = (msec - ck->ms) * frames / dur;
+    return id < frames ? id : frames - 1;
+}
+
+bool chunk_carry(chunk_t *dst, uint32_t dstlen, const chunk_t *src, uint32_t srclen)
+{
+    // learned frame counts of src kept in new list dst (both sorted), returns list changed (ms, srvid)
+    bool changed = dstlen != srclen;
+    uint32_t i = 0, j = 0;
+
+    while (i < dstlen && j < srclen)
+    {
+        if (dst[i].ms < src[j].ms)
+            i++, changed = true;
+        else if (dst[i].ms > src[j].ms)
+            j++, changed = true;
+        else
+        {
+            if (dst[i].srvid == src[j].srvid)
+                dst[i].frames = src[j].frames;
+            else
+                changed = true;
+            i++, j++;
+        }
+    }
+    return changed;
+}
+
+static const char *chunk_json_ws(const char *p, const char *e)
+{
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static const char *chunk_json_skip(const char *p, const char *e)
+{
+    // skip unknown value, stop at delimiter of enclosing object
+    int depth = 0;
+
+    for (; p < e; p++)
+    {
+        if (*p == '"')
+        {
+            for (p++; p < e && *p != '"'; p++)
+                if (*p == '\\')
+                    p++;
+            if (p >= e)
+                return NULL;
+        }
+        else if (*p == '[' || *p == '{')
+            depth++;
+        else if (*p == ']' || *p == '}')
+        {
+            if (!depth)
+                return p;
+            depth--;
+        }
+        else if (*p == ',' && !depth)
+            return p;
+    }
+    return NULL;
+}
+
+bool chunk_parse(chunk_index_t *ci, const char *p, size_t len)
+{
+    // /chunks response [{"srvid":N,"ts":["hex",...]},...] appended to ci without DOM
+    const char *e = p + len;
+
+#define JWS() (p = chunk_json_ws(p, e))
+#define JCH(c) (JWS() < e && *p == (c) && ++p)
+
+    if (!JCH('['))
+        return false;
+    if (JCH(']'))
+        return true;
+    do
+    {
+        uint32_t first = ci->len;
+        uint32_t srvid = 0;
+
+        if (!JCH('{'))
+            return false;
+        if (JCH('}'))
+            continue;
+        do
+        {
+            if (!JCH('"'))
+                return false;
+            const char *key = p;
+            while (p < e && *p != '"')
+                p++;
+            if (p >= e)
+                return false;
+            size_t klen = p++ - key;
+            if (!JCH(':'))
+                return false;
+            JWS();
+
+            if (klen == 5 && !memcmp(key, "srvid", 5))
+            {
+                const char *d = p;
+                for (srvid = 0; p < e && *p >= '0' && *p <= '9'; p++)
+                    srvid = srvid * 10 + *p - '0';
+                if (p == d || p - d > 3 || srvid > UINT8_MAX)
+                    return false;
+            }
+            else if (klen == 2 && !memcmp(key, "ts", 2))
+            {
+                if (!JCH('['))
+                    return false;
+                if (JCH(']'))
+                    continue;
+                do
+                {
+                    uint64_t ms = 0;
+
+                    if (!JCH('"'))
+                        return false;
+                    const char *h = p;
+                    for (; p < e && *p != '"'; p++)
+                    {
+                        if (*p >= '0' && *p <= '9')
+                            ms = ms << 4 | (*p - '0');
+                        else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+                            ms = ms << 4 | ((*p | 0x20) - 'a' + 10);
+                        else
+                            return false;
+                    }
+                    if (p >= e || p == h || p - h > 16)
+                        return false;
+                    p++;
+                    if (ci->len == ci->size)
+                        chunk_reserve(ci, ci->len + 1);
+                    ci->ch[ci->len++] = (chunk_t){.ms = ms}; // frames unknown, scratch may be reused
+                } while (JCH(','));
+                if (!JCH(']'))
+                    return false;
+            }
+            else if (!(p = chunk_json_skip(p, e)))
+                return false;
+        } while (JCH(','));
+        if (!JCH('}'))
+            return false;
+
+        // srvid may follow ts
+        for (uint32_t i = first; i < ci->len; i++)
+            ci->ch[i].srvid = srvid;
+    } while (JCH(','));
+
+    return JCH(']');
+#undef JCH
+#undef JWS
+}
+
+void chunk_watch_scan(int fd, int wd[UINT8_MAX + 1], const char *path, const char *day, uint32_t camid)
+{
+    // watch camera directory of each server, it appears with first chunk of the day
+    DIR *dir;
+    struct dirent *de;
+
+    if (!(dir = opendir(path)))
+        return;
+    while ((de = readdir(dir)))
+    {
+        int srvid;
+        char fn[256];
+        if (sscanf(de->d_name, "srv%d", &srvid) != 1 || srvid < 0 || srvid > UINT8_MAX || wd[srvid] >= 0)
+            continue;
+        snprintf(fn, sizeof(fn) - 1, "%s/" SRVF "/%s/" CAMF, path, srvid, day, camid);
+        if ((wd[srvid] = inotify_add_watch(fd, fn, IN_CLOSE_WRITE | IN_MOVED_TO)) >= 0)
+            LOG("W: watching %s\n", fn);
+    }
+    closedir(dir);
+}
+
+uint32_t chunk_watch_read(int wd[UINT8_MAX + 1], const char *buf, size_t len, chunk_t *ch)
+{
+    // chunks named by inotify events of one read, sorted for chunk_merge, removed directories unwatched
+    uint32_t chlen = 0;
+    const struct inotify_event *ev;
+
+    for (const char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+    {
+        int srvid, n;
+        uint64_t ms;
+        ev = (const struct inotify_event *)p;
+        for (srvid = 0; srvid <= UINT8_MAX && wd[srvid] != ev->wd; srvid++)
+            ;
+        if (srvid > UINT8_MAX)
+            continue;
+        if (ev->mask & IN_IGNORED)
+        {
+            wd[srvid] = -1; // directory removed
+            continue;
+        }
+        if (!ev->len || sscanf(ev->name, "%lx%n", &ms, &n) != 1 || strcmp(ev->name + n, ".ts"))
+            continue;
+        ch[chlen++] = (chunk_t){.ms = ms, .srvid = srvid};
+    }
+    if (chlen > 1)
+        qsort(ch, chlen, sizeof(ch[0]), compare_chunk);
+    return chlen;
+}
@@ -0,0 +1,62 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+#ifndef _CHUNK_H_
+#define _CHUNK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STREAM_FRAMES 100     // nominal frames per chunk, actual count learned at demux
+#define STREAM_FRAMES_MAX 255 // frames per chunk bound
+#define STREAM_FPS 25
+#define MS_IN_SEC (1000)
+#define STREAM_FPS_MSEC (MS_IN_SEC / STREAM_FPS)
+
+#define SRVF "srv%d"
+#define CAMF "cam%02d"
+
+#define CHUNK_INDEX_MIN 1024           // initial chunk index allocation, doubled on demand
+#define CHUNK_SLOT_MSEC 1000           // time to chunk lookup slot, less than chunk duration
+#define CHUNK_SLOT_MAX (2 * 24 * 3600) // slots per index, bsearch fallback above
+
+typedef struct chunk
+{
+    uint64_t ms;
+    uint8_t srvid;
+    uint8_t frames; // learned at demux, 0 unknown
+} chunk_t;
+
+typedef struct chunk_index
+{
+    chunk_t *ch; // sorted by ms
+    uint32_t len;
+    uint32_t size;
+    uint32_t *slot; // first chunk at or after slotbase + i * CHUNK_SLOT_MSEC
+    uint32_t slotlen;
+    uint32_t slotsize;
+    uint64_t slotbase;
+} chunk_index_t;
+
+static inline uint32_t chunk_frames(const chunk_t *ck)
+{
+    return ck->frames ? ck->frames : STREAM_FRAMES;
+}
+
+int compare_chunk(const void *a, const void *b);
+void chunk_reserve(chunk_index_t *ci, uint32_t len);
+void chunk_free(chunk_index_t *ci);
+void chunk_slots(chunk_index_t *ci);
+void chunk_slots_append(chunk_index_t *ci, uint32_t from);
+chunk_t *chunk_find(chunk_index_t *ci, uint64_t ms);
+chunk_t *chunk_get(chunk_index_t *ci, uint64_t ms);
+chunk_t *chunk_cursor(chunk_index_t *ci, uint32_t *cur, uint64_t ms);
+void chunk_merge(chunk_index_t *ci, chunk_t *src, uint32_t srclen, uint64_t cursor, bool *mismatch);
+uint32_t chunk_id(chunk_index_t *ci, chunk_t *ck, uint64_t msec);
+bool chunk_carry(chunk_t *dst, uint32_t dstlen, const chunk_t *src, uint32_t srclen);
+bool chunk_parse(chunk_index_t *ci, const char *p, size_t len);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+#ifndef _CHUNK_WATCH_H_
+#define _CHUNK_WATCH_H_
+
+#include <sys/inotify.h>
+
+#include "chunk.h"
+
+#define CHUNK_WATCH_EVENTS(len) ((len) / sizeof(struct inotify_event)) // chunks of one inotify read bound
+
+void chunk_watch_scan(int fd, int wd[UINT8_MAX + 1], const char *path, const char *day, uint32_t camid);
+uint32_t chunk_watch_read(int wd[UINT8_MAX + 1], const char *buf, size_t len, chunk_t *ch);
+
+#endif
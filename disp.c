@@ -4,6 +4,7 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <strings.h>
 #include <time.h>
@@ -25,6 +26,7 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 #include <inttypes.h>
 #include <signal.h>
 #include <limits.h>
+#include <poll.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -87,20 +89,61 @@ typedef struct hdr_static_metadata
     uint16_t min_cll;
 } hdr_static_metadata;
 
+enum plane_prop
+{
+    PP_FB_ID,
+    PP_CRTC_ID,
+    PP_SRC_X,
+    PP_SRC_Y,
+    PP_SRC_W,
+    PP_SRC_H,
+    PP_CRTC_X,
+    PP_CRTC_Y,
+    PP_CRTC_W,
+    PP_CRTC_H,
+    PP_REQUIRED, // above must exist
+    PP_ZPOS = PP_REQUIRED,
+    PP_COLOR_RANGE,
+    PP_COLOR_ENCODING,
+    PP_COUNT
+};
+
+static const char *plane_prop_names[PP_COUNT] = {"FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H", "ZPOS", "COLOR_RANGE", "COLOR_ENCODING"};
+
+#define DISP_FB_HASH 128 // prime_fd buckets per plane, fds are small and dense
+
+typedef struct fb
+{
+    uint32_t prime_fd;
+    uint32_t fb_id;
+    uint32_t handle; // buffer identity, fd number may be reused by other buffer
+    uint32_t idle;   // dropped by owner, kept for buffer reuse, 0 in use (or stamp)
+    int next;        // hash chain or free-list, -1 end
+} fb_t;
+
 typedef struct plane
 {
     uint32_t plane_id;
     drmModePropertyPtr plane_props[32];
+    uint32_t prop_ids[PP_COUNT]; // resolved at setup, 0 missing
     drmModeAtomicReqPtr request;
     uint32_t format, width, height, offsets[DISP_MAX_PLANES], pitches[DISP_MAX_PLANES], zpos;
     uint32_t last_fb_id;
+    bool on_crtc; // committed state has crtc (or plane found enabled at setup), flip event valid
     uint32_t s_x, s_y, s_width, s_height, s_fb_x, s_fb_y, s_fb_width, s_fb_height;
-
-    struct
-    {
-        int prime_fd;
-        uint32_t fb_id;
-    } frame_to_drm[DISP_PICTURE_HANDLES];
+    uint32_t screen_fd, pending_fd; // prime_fd on screen and committed, flip in flight
+    uint32_t screen_fb, pending_fb; // their fb_id, fd number may be reused by other buffer meanwhile
+    bool flipping;                  // commit in flight, completed by its page flip event
+    disp_release_t release;
+    void *release_data;
+
+    // prime_fd to framebuffer, entries grow by doubling from DISP_PICTURE_HANDLES
+    // framebuffers live as long as the decoder surface pool, idle ones over fbskeep are removed
+    fb_t *fbs;
+    int fbslen, fbssize, fbsidle, fbskeep;
+    int fb_hash[DISP_FB_HASH];
+    int fb_free;
+    uint32_t idle_stamp;
 } plane_t;
 
 struct
@@ -120,8 +163,194 @@ struct
 
     int crtc_width;
     int crtc_height;
+    uint32_t crtc_vblank; // crtc select of vblank requests
+    uint64_t vblank_ns;   // refresh period
+
+    // one commit in flight per plane, planes flip independently unless driver refuses overlap
+    pthread_t event_tid;
+    pthread_cond_t flip_cond;
+    int flips; // planes flipping
+    bool stopping;
 } disp;
 
+static int disp_fb_find(plane_t *plane, uint32_t prime_fd)
+{
+    // mutex held, entry index or -1
+    for (int id = plane->fb_hash[prime_fd % DISP_FB_HASH]; id >= 0; id = plane->fbs[id].next)
+        if (plane->fbs[id].prime_fd == prime_fd)
+            return id;
+    return -1;
+}
+
+static void disp_fb_grow(plane_t *plane, int size)
+{
+    // mutex held, new entries to free-list
+    CAVNZ(plane->fbs, realloc(plane->fbs, size * sizeof(fb_t)));
+    for (int id = size - 1; id >= plane->fbssize; id--)
+    {
+        plane->fbs[id].fb_id = plane->fbs[id].idle = 0;
+        plane->fbs[id].next = plane->fb_free;
+        plane->fb_free = id;
+    }
+    plane->fbssize = size;
+    if (size > DISP_PICTURE_HANDLES)
+        LOG("DISP: plane %d framebuffers %d\n", plane->plane_id, size);
+}
+
+static int disp_fb_add(plane_t *plane, uint32_t prime_fd)
+{
+    // mutex held, entry from free-list, fb_id filled by caller
+    if (plane->fb_free < 0)
+        disp_fb_grow(plane, plane->fbssize ? plane->fbssize * 2 : DISP_PICTURE_HANDLES);
+    int id = plane->fb_free;
+    fb_t *fb = plane->fbs + id;
+    plane->fb_free = fb->next;
+    fb->prime_fd = prime_fd;
+    fb->fb_id = 0;
+    fb->idle = 0;
+    fb->next = plane->fb_hash[prime_fd % DISP_FB_HASH];
+    plane->fb_hash[prime_fd % DISP_FB_HASH] = id;
+    plane->fbslen++;
+    return id;
+}
+
+static void disp_fb_unlink(plane_t *plane, int id)
+{
+    // mutex held, out of hash chain (not found by prime_fd any more), entry stays until removed
+    fb_t *fb = plane->fbs + id;
+    int *p = plane->fb_hash + fb->prime_fd % DISP_FB_HASH;
+    while (*p >= 0 && *p != id)
+        p = &plane->fbs[*p].next;
+    if (*p == id)
+        *p = fb->next;
+    fb->next = -1;
+}
+
+static bool disp_fb_busy(plane_t *plane, int id)
+{
+    // mutex held, on screen or committed
+    return plane->fbs[id].fb_id == plane->screen_fb || plane->fbs[id].fb_id == plane->pending_fb;
+}
+
+static void disp_fb_remove(plane_t *plane, int id)
+{
+    // mutex held, RmFB, unlink from chain to free-list
+    fb_t *fb = plane->fbs + id;
+    disp_fb_unlink(plane, id);
+    CAZ(drmModeRmFB(disp.fd, fb->fb_id));
+    if (fb->idle)
+        plane->fbsidle--;
+    fb->fb_id = fb->idle = 0;
+    fb->next = plane->fb_free;
+    plane->fb_free = id;
+    plane->fbslen--;
+}
+
+static void disp_fb_idle(plane_t *plane, int id)
+{
+    // mutex held, age stamp for trim, never 0
+    if (!++plane->idle_stamp)
+        plane->idle_stamp++;
+    plane->fbs[id].idle = plane->idle_stamp;
+    plane->fbsidle++;
+}
+
+static void disp_fb_trim(plane_t *plane, int keep)
+{
+    // mutex held, remove oldest idle framebuffers off screen, pool churns or shrinks
+    while (plane->fbsidle > keep)
+    {
+        int old = -1;
+        for (int id = 0; id < plane->fbssize; id++)
+            if (plane->fbs[id].idle && plane->fbs[id].fb_id && !disp_fb_busy(plane, id) &&
+                (old < 0 || (int32_t)(plane->fbs[id].idle - plane->fbs[old].idle) < 0))
+                old = id;
+        if (old < 0)
+            break; // rest on screen, next flip
+        disp_fb_remove(plane, old);
+    }
+}
+
+static void disp_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, unsigned int crtc_id, void *user_data)
+{
+    plane_t *plane = user_data;
+    uint32_t released = 0;
+    bool replaced;
+
+    CAZ(pthread_mutex_lock(&disp.mutex));
+    A(plane->flipping);
+    if (plane->screen_fd != plane->pending_fd)
+        released = plane->screen_fd;
+    replaced = plane->screen_fb != plane->pending_fb;
+    plane->screen_fd = plane->pending_fd;
+    plane->screen_fb = plane->pending_fb;
+    if (replaced)
+        disp_fb_trim(plane, plane->fbskeep);
+    plane->flipping = false;
+    disp.flips--;
+    CAZ(pthread_cond_broadcast(&disp.flip_cond));
+    CAZ(pthread_mutex_unlock(&disp.mutex));
+
+    if (plane->release)
+        plane->release(released, sequence, tv_sec * 1000000000ull + tv_usec * 1000ull, plane->release_data);
+}
+
+static void *disp_event_thread(void *data)
+{
+    drmEventContext ev = {.version = DRM_EVENT_CONTEXT_VERSION, .page_flip_handler2 = disp_flip_handler};
+    struct pollfd pfd = {.fd = disp.fd, .events = POLLIN};
+
+    LOG("DISP EVENT THREAD START\n");
+    while (!disp.stopping)
+    {
+        int ret = poll(&pfd, 1, 100);
+        if (ret < 0)
+        {
+            assert(errno == EINTR);
+            continue;
+        }
+        if (ret)
+            CAZ(drmHandleEvent(disp.fd, &ev));
+    }
+    LOG("DISP EVENT THREAD END\n");
+    return NULL;
+}
+
+static void disp_commit(plane_t *plane, uint32_t prime_fd, uint32_t fb_id)
+{
+    // mutex held, nonblocking, waits for previous flip of plane, of other plane only if driver busy with crtc
+    int ret;
+
+    while (plane->flipping)
+        CAZ(pthread_cond_wait(&disp.flip_cond, &disp.mutex));
+    while ((ret = drmModeAtomicCommit(disp.fd, plane->request, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, plane)) == -EBUSY)
+    {
+        A(disp.flips);
+        CAZ(pthread_cond_wait(&disp.flip_cond, &disp.mutex));
+    }
+    CAZ(ret);
+    plane->flipping = true;
+    disp.flips++;
+    plane->pending_fd = prime_fd;
+    plane->pending_fb = fb_id;
+}
+
+static void disp_plane_props(plane_t *plane)
+{
+    // property ids by name once, commits add them by id
+    for (int p = 0; p < PP_COUNT; p++)
+    {
+        for (drmModePropertyPtr *props = plane->plane_props; *props && !plane->prop_ids[p]; props++)
+            if (!strcasecmp(plane_prop_names[p], (*props)->name))
+                plane->prop_ids[p] = (*props)->prop_id;
+        if (!plane->prop_ids[p])
+        {
+            LOG("PLANE %d missing property %s\n", plane->plane_id, plane_prop_names[p]);
+            A(p >= PP_REQUIRED);
+        }
+    }
+}
+
 void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_width, uint32_t *crtc_height)
 {
     int i, j;
@@ -130,6 +359,14 @@ void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_widt
     A(vi && ui);
 
     CAZ(pthread_mutex_init(&disp.mutex, NULL));
+    CAZ(pthread_cond_init(&disp.flip_cond, NULL));
+    for (i = 0; i < sizeof(disp.planes) / sizeof(disp.planes[0]); i++)
+    {
+        disp.planes[i].fb_free = -1;
+        disp.planes[i].fbskeep = DISP_PICTURE_HANDLES;
+        for (j = 0; j < DISP_FB_HASH; j++)
+            disp.planes[i].fb_hash[j] = -1;
+    }
 
     disp.fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
     A(disp.fd >= 0);
@@ -229,6 +466,11 @@ void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_widt
     disp.crtc_height = crtc->height;
     uint32_t crtc_bit = (1 << i);
 
+    disp.crtc_vblank = i > 1 ? (i << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK : i ? DRM_VBLANK_SECONDARY : 0;
+    A(crtc->mode_valid && crtc->mode.clock);
+    disp.vblank_ns = (uint64_t)crtc->mode.htotal * crtc->mode.vtotal * 1000000 / crtc->mode.clock;
+    LOG("CRTC id: %d %dx%d@%d vblank %" PRIu64 " ns\n", disp.crtc_id, disp.crtc_width, disp.crtc_height, crtc->mode.vrefresh, disp.vblank_ns);
+
     drmModePlaneRes *plane_resources;
     CAVNZ(plane_resources, drmModeGetPlaneResources(disp.fd));
     A(plane_resources);
@@ -258,6 +500,8 @@ void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_widt
                 DBG("PLANE PROP: %s=%" PRIu64 "\n", prop->name, props->prop_values[j]);
                 if (!strcmp(prop->name, "type"))
                     type = props->prop_values[j];
+                if (!strcmp(prop->name, "CRTC_ID") && props->prop_values[j])
+                    disp.planes[i].on_crtc = true;
                 disp.planes[i].plane_props[j] = prop;
             }
             drmModeFreeObjectProperties(props);
@@ -290,6 +534,8 @@ void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_widt
 
     CAVNZ(disp.vi_plane->request, drmModeAtomicAlloc());
     CAVNZ(disp.ui_plane->request, drmModeAtomicAlloc());
+    disp_plane_props(disp.vi_plane);
+    disp_plane_props(disp.ui_plane);
 
     *ui = disp.ui_plane;
     *vi = disp.vi_plane;
@@ -297,24 +543,53 @@ void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_widt
     *crtc_height = disp.crtc_height;
 
     LOG("PLANE VI %d UI %d\n", disp.vi_plane->plane_id, disp.ui_plane->plane_id);
+
+    CAZ(pthread_create(&disp.event_tid, NULL, disp_event_thread, NULL));
 }
 
 void disp_cleanup(void)
 {
+    disp.stopping = true;
+    CAZ(pthread_join(disp.event_tid, NULL));
+    for (int i = 0; i < sizeof(disp.planes) / sizeof(disp.planes[0]); i++)
+        free(disp.planes[i].fbs);
 }
 
-static int drm_object_add_property(drmModeAtomicReq *request, uint32_t id, drmModePropertyPtr *props, char *name, uint64_t value)
+void disp_plane_release(plane_t *plane, disp_release_t release, void *data)
 {
-    while (*props)
-    {
-        if (!strcasecmp(name, (*props)->name))
-        {
-            return drmModeAtomicAddProperty(request, id, (*props)->prop_id, value);
-        }
-        props++;
-    }
-    DBG("ignore bad DRM roperty %s\n", name);
-    return INT_MAX;
+    CAZ(pthread_mutex_lock(&disp.mutex));
+    plane->release = release;
+    plane->release_data = data;
+    CAZ(pthread_mutex_unlock(&disp.mutex));
+}
+
+void disp_plane_flush(plane_t *plane)
+{
+    // until last commit of plane is on screen
+    CAZ(pthread_mutex_lock(&disp.mutex));
+    while (plane->flipping)
+        CAZ(pthread_cond_wait(&disp.flip_cond, &disp.mutex));
+    CAZ(pthread_mutex_unlock(&disp.mutex));
+}
+
+static void disp_plane_add(plane_t *plane, enum plane_prop prop, uint64_t value)
+{
+    // mutex held, optional property missing on this plane is skipped
+    if (plane->prop_ids[prop])
+        CAP(drmModeAtomicAddProperty(plane->request, plane->plane_id, plane->prop_ids[prop], value));
+}
+
+static void disp_plane_off(plane_t *plane)
+{
+    // mutex held, plane already off has no crtc in state, flip event would be refused (or never come)
+    plane->last_fb_id = 0; // next picture sets plane up again
+    if (!plane->on_crtc)
+        return;
+    drmModeAtomicSetCursor(plane->request, 0);
+    disp_plane_add(plane, PP_FB_ID, 0);
+    disp_plane_add(plane, PP_CRTC_ID, 0);
+    disp_commit(plane, 0, 0);
+    plane->on_crtc = false;
 }
 
 void disp_plane_create(plane_t *plane, uint32_t format, uint32_t width, uint32_t height, uint32_t bpp, int *prime_fd, uint32_t *pitch, uint32_t *size, uint32_t **map)
@@ -344,6 +619,32 @@ void disp_plane_create(plane_t *plane, uint32_t format, uint32_t width, uint32_t
     }
 }
 
+void disp_plane_destroy(plane_t *plane, int prime_fd, uint32_t size, uint32_t *map)
+{
+    // buffer of disp_plane_create, its framebuffer goes too (once off screen)
+    struct drm_mode_destroy_dumb destroy_req;
+    int id;
+
+    CAZ(pthread_mutex_lock(&disp.mutex));
+    if ((id = disp_fb_find(plane, prime_fd)) >= 0)
+    {
+        if (!plane->fbs[id].idle)
+            disp_fb_idle(plane, id);
+        if (disp_fb_busy(plane, id))
+            disp_fb_unlink(plane, id); // trimmed once replaced on screen
+        else
+            disp_fb_remove(plane, id);
+    }
+    memset(&destroy_req, 0, sizeof(struct drm_mode_destroy_dumb));
+    CAZ(drmPrimeFDToHandle(disp.fd, prime_fd, &destroy_req.handle));
+    CAZ(pthread_mutex_unlock(&disp.mutex));
+
+    if (map)
+        CAZ(munmap(map, size));
+    CAZ(close(prime_fd));
+    CAZ(drmIoctl(disp.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_req));
+}
+
 void disp_plane_setup(plane_t *plane, uint32_t format, uint32_t width, uint32_t height, uint32_t pitches[DISP_MAX_PLANES], uint32_t offsets[DISP_MAX_PLANES], uint32_t zpos)
 {
     CAZ(pthread_mutex_lock(&disp.mutex));
@@ -352,10 +653,7 @@ void disp_plane_setup(plane_t *plane, uint32_t format, uint32_t width, uint32_t
         goto not_changed;
     else
         A(!plane->format);
-    drmModeAtomicSetCursor(plane->request, 0);
-    CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "FB_ID", 0));
-    CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_ID", 0));
-    CAZ(drmModeAtomicCommit(disp.fd, plane->request, DRM_MODE_ATOMIC_NONBLOCK, NULL));
+    disp_plane_off(plane);
 
     plane->format = format;
     plane->width = width;
@@ -372,12 +670,7 @@ void disp_plane_hide(plane_t *plane)
 {
     CAZ(pthread_mutex_lock(&disp.mutex));
 
-    drmModeAtomicSetCursor(plane->request, 0);
-    CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "FB_ID", 0));
-    CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_ID", 0));
-    CAZ(drmModeAtomicCommit(disp.fd, plane->request, DRM_MODE_ATOMIC_NONBLOCK, NULL));
-
-    plane->last_fb_id = 0;
+    disp_plane_off(plane);
 
     CAZ(pthread_mutex_unlock(&disp.mutex));
 }
@@ -399,15 +692,15 @@ void disp_plane_scale(plane_t *plane, uint32_t x, uint32_t y, uint32_t width, ui
         CAZ(pthread_mutex_lock(&disp.mutex));
 
         drmModeAtomicSetCursor(plane->request, 0);
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_X", x << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_Y", y << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_W", width << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_H", height << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_X", fb_x));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_Y", fb_y));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_W", fb_width));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_H", fb_height));
-        CAZ(drmModeAtomicCommit(disp.fd, plane->request, 0, NULL));
+        disp_plane_add(plane, PP_SRC_X, x << 16);
+        disp_plane_add(plane, PP_SRC_Y, y << 16);
+        disp_plane_add(plane, PP_SRC_W, width << 16);
+        disp_plane_add(plane, PP_SRC_H, height << 16);
+        disp_plane_add(plane, PP_CRTC_X, fb_x);
+        disp_plane_add(plane, PP_CRTC_Y, fb_y);
+        disp_plane_add(plane, PP_CRTC_W, fb_width);
+        disp_plane_add(plane, PP_CRTC_H, fb_height);
+        disp_commit(plane, plane->pending_fd, plane->pending_fb);
 
         CAZ(pthread_mutex_unlock(&disp.mutex));
     }
@@ -416,95 +709,130 @@ void disp_plane_scale(plane_t *plane, uint32_t x, uint32_t y, uint32_t width, ui
 void disp_plane_show_pic(plane_t *plane, uint32_t prime_fd)
 {
     CAZ(pthread_mutex_lock(&disp.mutex));
-    int id;
+    int id = disp_fb_find(plane, prime_fd);
+    uint32_t handle;
 
-    for (id = 0; id < DISP_PICTURE_HANDLES; id++)
+    if (id >= 0 && plane->fbs[id].idle)
     {
-        if (prime_fd == plane->frame_to_drm[id].prime_fd)
-            break;
+        // buffer came back from decoder, same fd may be other buffer meanwhile
+        CAZ(drmPrimeFDToHandle(disp.fd, prime_fd, &handle));
+        if (handle == plane->fbs[id].handle)
+        {
+            plane->fbs[id].idle = 0;
+            plane->fbsidle--;
+        }
+        else
+        {
+            // old buffer may still be scanned out, RmFB would turn plane off: trimmed once replaced on screen
+            if (disp_fb_busy(plane, id))
+                disp_fb_unlink(plane, id);
+            else
+                disp_fb_remove(plane, id);
+            id = -1;
+        }
     }
 
-    if (id == DISP_PICTURE_HANDLES)
+    if (id < 0)
     {
-        for (id = 0; id < DISP_PICTURE_HANDLES; id++)
-            if (!plane->frame_to_drm[id].prime_fd)
-                break;
-        A(id < DISP_PICTURE_HANDLES);
-        plane->frame_to_drm[id].prime_fd = prime_fd;
+        id = disp_fb_add(plane, prime_fd);
 
-        uint32_t handle;
         CAZ(drmPrimeFDToHandle(disp.fd, prime_fd, &handle));
+        plane->fbs[id].handle = handle;
 
         uint32_t handles[DISP_MAX_PLANES];
         for (int j = 0; j < DISP_MAX_PLANES; j++)
             handles[j] = handle;
 
-        CAZ(drmModeAddFB2(disp.fd, plane->width, plane->height, plane->format, handles, plane->pitches, plane->offsets, &plane->frame_to_drm[id].fb_id, 0));
+        CAZ(drmModeAddFB2(disp.fd, plane->width, plane->height, plane->format, handles, plane->pitches, plane->offsets, &plane->fbs[id].fb_id, 0));
 
-        DBG("ID[%d] %d\n", id, prime_fd, plane->frame_to_drm[id].fb_id);
+        DBG("ID[%d] %d %d\n", id, prime_fd, plane->fbs[id].fb_id);
     }
+    uint32_t fb_id = plane->fbs[id].fb_id;
 
     if (plane->last_fb_id)
     {
         drmModeAtomicSetCursor(plane->request, 0);
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "FB_ID", plane->frame_to_drm[id].fb_id));
-        CAZ(drmModeAtomicCommit(disp.fd, plane->request, 0, NULL));
+        disp_plane_add(plane, PP_FB_ID, fb_id);
+        disp_commit(plane, prime_fd, fb_id);
     }
     else
     {
         drmModeAtomicSetCursor(plane->request, 0);
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "FB_ID", plane->frame_to_drm[id].fb_id));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_ID", disp.crtc_id));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_X", plane->s_x << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_Y", plane->s_y << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_W", plane->s_width << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "SRC_H", plane->s_height << 16));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_X", plane->s_fb_x));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_Y", plane->s_fb_y));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_W", plane->s_fb_width));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "CRTC_H", plane->s_fb_height));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "ZPOS", plane->zpos));
-        // CAP(drm_object_add_property(plane->request, 37, plane->plane_props, "alpha", 10000));
-        // CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "COLOR_ENCODING", DRM_COLOR_YCBCR_BT709));
-        CAP(drm_object_add_property(plane->request, plane->plane_id, plane->plane_props, "COLOR_RANGE", DRM_COLOR_YCBCR_FULL_RANGE));
-        CAZ(drmModeAtomicCommit(disp.fd, plane->request, 0, NULL));
+        disp_plane_add(plane, PP_FB_ID, fb_id);
+        disp_plane_add(plane, PP_CRTC_ID, disp.crtc_id);
+        disp_plane_add(plane, PP_SRC_X, plane->s_x << 16);
+        disp_plane_add(plane, PP_SRC_Y, plane->s_y << 16);
+        disp_plane_add(plane, PP_SRC_W, plane->s_width << 16);
+        disp_plane_add(plane, PP_SRC_H, plane->s_height << 16);
+        disp_plane_add(plane, PP_CRTC_X, plane->s_fb_x);
+        disp_plane_add(plane, PP_CRTC_Y, plane->s_fb_y);
+        disp_plane_add(plane, PP_CRTC_W, plane->s_fb_width);
+        disp_plane_add(plane, PP_CRTC_H, plane->s_fb_height);
+        disp_plane_add(plane, PP_ZPOS, plane->zpos);
+        // disp_plane_add(plane, PP_COLOR_ENCODING, DRM_COLOR_YCBCR_BT709);
+        disp_plane_add(plane, PP_COLOR_RANGE, DRM_COLOR_YCBCR_FULL_RANGE);
+        disp_commit(plane, prime_fd, fb_id);
+        plane->on_crtc = true;
     }
 
-    plane->last_fb_id = plane->frame_to_drm[id].fb_id;
+    plane->last_fb_id = fb_id;
 
     CAZ(pthread_mutex_unlock(&disp.mutex));
 }
 
 void disp_plane_drop_pic(plane_t *plane, uint32_t prime_fd)
 {
+    // frame released by owner, framebuffer kept for buffer reuse, all (0) on surface pool teardown
     CAZ(pthread_mutex_lock(&disp.mutex));
-    int id, fbs = 0;
+    int id;
 
-    for (id = 0; id < DISP_PICTURE_HANDLES; id++)
+    if (!prime_fd)
     {
-        if (!prime_fd || prime_fd == plane->frame_to_drm[id].prime_fd)
-        {
-            if (plane->last_fb_id == plane->frame_to_drm[id].fb_id)
-                plane->last_fb_id = 0;
-            CAZ(drmModeRmFB(disp.fd, plane->frame_to_drm[id].fb_id));
-            plane->frame_to_drm[id].fb_id = 0;
-            plane->frame_to_drm[id].prime_fd = 0;
-        }
-        if (plane->frame_to_drm[id].fb_id)
-            fbs++;
+        for (id = 0; id < plane->fbssize; id++)
+            if (plane->fbs[id].fb_id && !plane->fbs[id].idle)
+                disp_fb_idle(plane, id);
+        disp_fb_trim(plane, 0);
     }
-
-    if (id < DISP_PICTURE_HANDLES)
+    else if ((id = disp_fb_find(plane, prime_fd)) >= 0 && !plane->fbs[id].idle)
+    {
+        disp_fb_idle(plane, id);
+        disp_fb_trim(plane, plane->fbskeep);
+    }
+    else
         DBG("DISP: prime_fd not registered %d\n", prime_fd);
+
+    DBG("DISP: framebuffers %d idle %d\n", plane->fbslen, plane->fbsidle);
     CAZ(pthread_mutex_unlock(&disp.mutex));
 }
 
-void disp_wait(void)
+void disp_plane_reserve(plane_t *plane, uint32_t frames)
 {
-    drm_wait_vblank_t wait_vblank;
-    wait_vblank.request.type = _DRM_VBLANK_RELATIVE;
-    wait_vblank.request.sequence = 1;
-    wait_vblank.request.signal = 0;
+    // frames held by owner at once, framebuffers for them allocated and kept idle for buffer reuse
+    CAZ(pthread_mutex_lock(&disp.mutex));
+    int size = plane->fbssize ? plane->fbssize : DISP_PICTURE_HANDLES;
+    while (size < (int)frames)
+        size *= 2;
+    if (size > plane->fbssize)
+        disp_fb_grow(plane, size);
+    plane->fbskeep = (int)frames > DISP_PICTURE_HANDLES ? (int)frames : DISP_PICTURE_HANDLES;
+    CAZ(pthread_mutex_unlock(&disp.mutex));
+}
 
-    CAZ(drmIoctl(disp.fd, DRM_IOCTL_MODE_CREATE_DUMB, &wait_vblank));
+uint32_t disp_wait(uint32_t sequence, uint64_t *ns)
+{
+    // until absolute vblank sequence (0 next one), returns actual sequence and its CLOCK_MONOTONIC time
+    drmVBlank vbl;
+    vbl.request.type = (sequence ? DRM_VBLANK_ABSOLUTE : DRM_VBLANK_RELATIVE) | disp.crtc_vblank;
+    vbl.request.sequence = sequence ? sequence : 1;
+    vbl.request.signal = 0;
+
+    CAZ(drmWaitVBlank(disp.fd, &vbl));
+    if (ns)
+        *ns = vbl.reply.tval_sec * 1000000000ull + vbl.reply.tval_usec * 1000ull;
+    return vbl.reply.sequence;
+}
+
+uint64_t disp_vblank_ns(void)
+{
+    return disp.vblank_ns;
 }
@@ -29,6 +29,8 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <regex.h>
+#include <poll.h>
+#include <sys/inotify.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -56,18 +58,16 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 #include "globals.h"
 #include "hid.h"
 #include "disp.h"
+#include "chunk.h"
+#include "chunk_watch.h"
 
 #undef DBG
 #define DBG(...)
 
 #define LOOP_USLEEP (500 * 1000)
 
-#define STREAM_FRAMES 100
-#define STREAM_FPS 25
-#define MS_IN_SEC (1000)
 #define NS_IN_SEC (1000000000l)
 #define NS_IN_MSEC (1000000l)
-#define STREAM_FPS_MSEC (MS_IN_SEC / STREAM_FPS)
 #define STREAM_FPS_NSEC (NS_IN_SEC / STREAM_FPS)
 
 #define SKIP_START 500 * NS_IN_MSEC
@@ -75,8 +75,16 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 
 #define FRAMES_PRELOAD 20
 #define FRAMES_TRESHOLD 26
-
-#define STREAM_MAX_FILES 24000
+#define STREAM_GOP_CACHE 16 // chunks with keyframe index
+#define FRAMES_REVERSE_RESERVE (FRAMES_TRESHOLD * 3 / 2) // frame cache kept free by reverse thread for decoder thread
+#define FRAMES_CACHE_BITS 7                             // frame cache index initial, grown to 2x frames of budget
+#define FRAMES_CACHE_MEM_SHARE 2                        // frame cache budget capped to 1/N of physical memory
+#define STREAM_PES_MAX (1024 * 1024) // pooled packet buffer, larger frames reallocated
+#define TS_PACKET 188
+
+#define CHUNK_RESYNC 60 // full chunk list resync period (sec), delta sync otherwise
+#define CHUNK_PREFETCH 5 // mat cameras chunk list refresh period (sec)
+#define WATCH_POLL_MSEC 100
 #define MAX_CAM 4
 #define MAX_MAT 8
 #define MAX_BROWSE (4 * 8)
@@ -86,9 +94,21 @@ SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
 #define MEDICAL_EXTEND 20 // timeframe to extend existing medical start or stop
 #define MEDICAL_DELETE 5  // minimum medical duration, otherwise delete
 #define BOOKMARK_DELAY 5  // GUI select time
+#define BOOKMARK_PRELOAD 6 // bookmarks pre-decoded while GUI_BOOKMARKS is open
+#define BOOKMARK_FRAMES 2  // pre-decoded frames per bookmark
+#define PACE_BUCKETS 16    // pacing histogram buckets, last one overflow
+#define SHOW_QUEUE 16      // decoder to show presentation queue, power of two
+#ifndef PACE_RING_BITS
+#define PACE_RING_BITS 9 // presented frames kept for pacing dump
+#endif
+#define PACE_RING (1 << PACE_RING_BITS)
 
-#define SRVF "srv%d"
-#define CAMF "cam%02d"
+
+#define CHUNK_CACHE_DIR "%s/cache" // in data path
+#define CHUNK_CACHE_FILE CHUNK_CACHE_DIR "/%s-" CAMF ".idx"
+#define CHUNK_CACHE_MAGIC 0x33494b43 // "CKI3", little endian: magic, chunks (u32), then ms (u64), srvid, frames (u8) each
+#define CHUNK_CACHE_HEAD 8
+#define CHUNK_CACHE_ENTRY 10
 
 typedef enum
 {
@@ -183,15 +203,83 @@ typedef struct
 {
     uint8_t *b;
     size_t blen;
+    size_t pos;
 } bd_t;
 
+typedef struct swframe
+{
+    int fd; // prime fd of dumb buffer, NV12 Y + UV, then U + V planes of decoder
+    uint32_t pitch;
+    uint32_t size;
+    uint32_t height; // aligned
+    uint8_t *map;
+} swframe_t;
+
+typedef struct gop
+{
+    uint64_t ms; // chunk
+    uint32_t len;
+    struct
+    {
+        int64_t pos; // byte offset of keyframe packet
+        uint32_t id; // frame id
+    } key[STREAM_FRAMES_MAX];
+    uint32_t frames;
+    uint16_t msec[STREAM_FRAMES_MAX]; // frame PTS from chunk start
+} gop_t;
+
+typedef struct decoder
+{
+    AVCodecContext *ctx;
+    bool read_packet;
+    uint64_t ms; // decoding chunk
+    uint32_t id; // next frame
+    bd_t bd;     // demux cursor in map
+    gop_t gop[STREAM_GOP_CACHE];
+    uint32_t gopnext;
+    AVFrame *frame;   // shell for next receive
+    AVPacket packet;  // last demuxed, its buffer reused by next read once decoder let it go
+    AVFrame *convert; // decoded in other pixel format, sampled into dumb buffer (swdec_convert)
+    bool side;        // frames to bookmark side cache
+
+    bd_t map; // mapped chunk
+    int map_fd;
+    uint64_t map_ms;
+} decoder_t;
+
 typedef struct frame_cache
 {
-    uint64_t ms;
+    uint64_t ms; // 0 empty slot
     uint32_t id;
+    uint32_t mark; // eviction sweep
     AVFrame *frame;
+    uint64_t msec; // presentation time
 } frame_cache_t;
 
+typedef struct showq
+{
+    uint64_t ms;
+    uint32_t id;
+    uint32_t gen; // stale after seek or speed change
+    int speed;
+    AVFrame *frame; // owned by frame cache, kept there while queued
+    uint64_t msec;
+} showq_t;
+
+#define PACE_MISS 1   // show stalled on frame missing in cache before this one
+#define PACE_SYNC 2   // cadence restarted, commit missed its vblank
+#define PACE_DROP 4   // no vblank of its own, previous frame target reused
+
+typedef struct pace
+{
+    uint64_t due_ns;   // intended vblank, CLOCK_MONOTONIC
+    uint64_t start_ns; // commit start
+    uint64_t done_ns;  // commit return
+    uint64_t flip_ns;  // page flip event, 0 not seen
+    int32_t late;      // flip vblanks past target, -1 unknown
+    uint32_t flags;    // PACE_*
+} pace_t;
+
 typedef struct config
 {
     uint32_t camid;
@@ -199,11 +287,12 @@ typedef struct config
     uint32_t position;
 } config_t;
 
-typedef struct chunk
+typedef struct chunk_prefetch
 {
-    uint64_t ms;
-    uint8_t srvid;
-} chunk_t;
+    uint32_t camid;
+    char day[4 + 1 + 2 + 1 + 2 + 1];
+    chunk_index_t ci;
+} chunk_prefetch_t;
 
 typedef struct img
 {
@@ -228,8 +317,11 @@ struct
     // file stream
     bool stream_initialized;
     pthread_t loader_tid;
-    chunk_t ch[STREAM_MAX_FILES];
-    uint32_t chlen;
+    pthread_t watcher_tid;
+    chunk_index_t chi; // decoder_mutex
+    pthread_t prefetch_tid;
+    pthread_mutex_t prefetch_mutex;
+    chunk_prefetch_t prefetch[MAX_CAM]; // prefetch_mutex, by position
 
     // command
     pthread_mutex_t cmd_mutex;
@@ -291,40 +383,95 @@ struct
     // decoder
     pthread_mutex_t decoder_mutex;
     pthread_cond_t decoder_cond;
+    pthread_cond_t loader_cond;
     pthread_t decoder_tid;
+    bool decoder_wake; // targeted wakeup: refill point, seek, speed change, new chunks
 
     // public
-    frame_cache_t frm[DISP_PICTURE_HANDLES];
+    frame_cache_t *frm; // open addressed by ms/id, 1 << frmbits slots
+    uint32_t frmbits;
     uint32_t frmlen;
+    uint32_t frm_mark;
+
+    // run of cached frames ahead of playhead in play order
+    int frm_dir; // 0 recount
+    uint32_t frm_skip;
+    uint64_t frm_head_ms;
+    uint32_t frm_head_id;
+    uint64_t frm_tail_ms; // first missing, 0 end of index
+    uint32_t frm_tail_id;
+    uint32_t frm_tail_ck, frm_ck; // stream.chi cursors
+    uint32_t frm_ahead;
+
+    // budget from decoded frame size
+    uint32_t frm_size;
+    uint32_t frm_max, frm_behind, frm_treshold, frm_reserve; // frames
+    uint64_t frm_hits, frm_misses, frm_evicts, frm_adds;
+    uint64_t open_count, open_ns, gop_count, gop_ns; // chunk open (map, fault in) and keyframe index latency, atomic
+
+    // unreferenced AVFrame shells for decoders
+    AVFrame **shells;
+    uint32_t shellslen, shellssize; // sized by frame budget
 
     // private
-    AVCodecContext *decoder_ctx;
     AVBufferRef *hw_device_ctx;
-    bool decode_read_packet;
-    AVIOContext *avio_ctx;
-    AVFormatContext *input_ctx;
+    const AVCodec *codec;
+    AVCodecParameters *codecpar;
+    AVBufferPool *decode_pool;
+    uint32_t video_pid;
+    bool swdec;
+    pthread_mutex_t swdec_mutex;
+    AVBufferPool *swdec_pool; // dumb buffers of decoder geometry, swdec_mutex
+    uint32_t swdec_width, swdec_height, swframes;
     int stream_index;
 
-    uint64_t decode_ms;
-    uint32_t decode_id;
-    bd_t decode_bd;
+    decoder_t dec; // decoder thread
+    decoder_t rev; // reverse thread
+
+    // reverse, decoder_mutex
+    pthread_t reverse_tid;
+    pthread_cond_t reverse_cond;
+    uint64_t reverse_ms; // request of next older segment
+    uint32_t reverse_from, reverse_to, reverse_skip;
+    bool reverse_busy;
 
-    bd_t decoder_loader_bd;
-    int decoder_loader_fd;
-    uint64_t decoder_loader_ms;
+    // bookmark side cache, decoder_mutex, filled by reverse thread
+    frame_cache_t bmk[BOOKMARK_PRELOAD * BOOKMARK_FRAMES];
+    uint32_t bmklen;
+    bool bookmark_pending;
 
     // show
     pthread_t show_tid;
     uint32_t show_skip; // skip frames (modulo)
     uint64_t show_wait; // inter frame wait in ns
 
-    // private
-    uint64_t show_a_ms, show_p_ms;
-    uint32_t show_a_id, show_p_id;
-
-    // decoder_mutex
-    uint64_t show_ms; // actual show
+    // presentation queue, single producer (decoder thread), single consumer (show thread)
+    showq_t showq[SHOW_QUEUE];
+    uint32_t showq_head; // decoder thread
+    uint32_t showq_rd;   // show thread, next to pop
+    uint32_t showq_tail; // show thread, oldest entry possibly on screen
+    uint32_t showq_shown; // show thread, last committed entry
+    uint32_t showq_wake; // decoder thread, show wakes decoder when popping it
+    uint32_t showq_gen;  // decoder_mutex
+
+    // decoder_mutex, queue feed cursor
+    uint64_t show_ms; // next to queue
     uint32_t show_id;
+    uint32_t show_ck; // stream.chi cursor of show_ms
+    bool show_queued; // cursor frame already queued
+    int showq_speed;
+    uint32_t showq_skip;
+    uint32_t show_flip_seq; // last video plane flip, disp event thread
+    uint64_t show_flip_ns;
+
+    // pacing ring and histograms, show thread writes, any thread reads
+    pace_t pace[PACE_RING];
+    uint32_t pace_head;
+    uint64_t pace_jitter[PACE_BUCKETS]; // |flip - due| in ms
+    uint64_t pace_late[PACE_BUCKETS];   // flip vblanks past target
+    uint64_t pace_frames, pace_repeats, pace_drops, pace_misses, pace_syncs;
+    int pace_dump; // SIGUSR1 request
+    int signaled;  // fatal signal, main loop dumps and exits
 
     uint64_t show_msec;
     uint64_t show_msec_seek;
@@ -360,6 +507,19 @@ struct
 #define INFO_DRAW_FINGER false
 #endif
 
+#ifndef STREAM_WATCH
+#define STREAM_WATCH true // local chunk discovery (inotify) next to master polling
+#endif
+#ifndef STREAM_PREFETCH
+#define STREAM_PREFETCH true // keep chunk lists of all mat cameras for fast camera switch
+#endif
+#ifndef STREAM_SWDEC
+#define STREAM_SWDEC false // software decode (frame threads) instead of DRM hw decode, also fallback
+#endif
+#ifndef FRAMES_CACHE_MB
+#define FRAMES_CACHE_MB 192 // decoded frame cache budget, capped by physical memory
+#endif
+
 #define INFO_PREFIX "resources/"
 #define INFO_FONT INFO_PREFIX "DejaVuSansMono-Bold.ttf"
 #define INFO_TIMG INFO_PREFIX "t%d.png"
@@ -458,6 +618,8 @@ struct
 #define HID_ZOOM_MAX (600)
 
 void info_cfg_load();
+void chunk_cache_remove(char *day);
+void stream_show_playhead(uint64_t *ms, uint32_t *id);
 
 config_t *get_config(uint8_t camid)
 {
@@ -976,6 +1138,7 @@ void hid_event(int fd, struct input_event *ev)
                         else if (action == A_BRS_DELETE && (param < stream.info_browselen && !strcmp(stream.info_browse[param], stream.day)))
                         {
                             LOG("DELETE: %s\n", stream.day);
+                            chunk_cache_remove(stream.day);
                             stream.info_browse_deleting = true;
                             stream.info_changed = true;
 
@@ -1291,6 +1454,11 @@ void hid_event(int fd, struct input_event *ev)
                         case A_BOOKMARK_SHOW:
                         {
                             stream.gui = stream.gui == GUI_PLAYER ? GUI_BOOKMARKS : GUI_PLAYER;
+                            // pre-decode bookmarks or drop them
+                            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+                            stream.bookmark_pending = true;
+                            CAZ(pthread_cond_signal(&stream.reverse_cond));
+                            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
                             stream.hid_action = action;
                             stream.hid_param = param;
                             stream.info_changed = true;
@@ -1764,6 +1932,7 @@ void *stream_info_thread(void *param)
 
         stream.info_changed = false;
 
+        disp_plane_flush(stream.ui); // back buffer off screen
         fb = (fb + 1) % 2;
         info_fill(fb, 0, 0, INFO_WIDTH, INFO_HEIGHT, 0);
 
@@ -2100,22 +2269,305 @@ void info_cleanup(void)
 {
 }
 
+// +++ CHUNK INDEX
+
+uint64_t chunk_step(uint64_t ms, int step)
+{
+    // neighbour chunk in stream.chi, 0 outside
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    chunk_t *ck = chunk_get(&stream.chi, ms);
+    int64_t idx = ck ? ck - stream.chi.ch + step : -1;
+    ms = (idx >= 0 && idx < stream.chi.len) ? stream.chi.ch[idx].ms : 0;
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    return ms;
+}
+
+int chunk_fetch(chunk_index_t *ci, char *day, uint32_t camid, uint64_t from)
+{
+    // master chunk list (from 0 = full), sorted into ci, returns http status
+    struct _u_request request;
+    struct _u_response response;
+    char _cam[4], _from[17];
+
+    CAP(snprintf(_cam, sizeof(_cam), "%u", camid));
+    CAP(snprintf(_from, sizeof(_from), "%lx", from));
+
+    ulfius_init_request(&request);
+    ulfius_init_response(&response);
+    CAZ(ulfius_set_request_properties(&request,
+                                      U_OPT_HTTP_VERB, "GET",
+                                      U_OPT_HTTP_URL, stream.masteruri,
+                                      U_OPT_HTTP_URL_APPEND, "/chunks/",
+                                      U_OPT_HTTP_URL_APPEND, day,
+                                      U_OPT_HTTP_URL_APPEND, "/",
+                                      U_OPT_HTTP_URL_APPEND, _cam,
+                                      U_OPT_TIMEOUT, 10ul,
+                                      U_OPT_NONE));
+    if (from)
+        CAZ(ulfius_set_request_properties(&request,
+                                          U_OPT_URL_PARAMETER, "from", _from,
+                                          U_OPT_NONE));
+    CAZ(ulfius_send_http_request(&request, &response));
+    int status = response.status;
+
+    ci->len = 0;
+    if (status / 100 == 2)
+        CA(chunk_parse(ci, response.binary_body, response.binary_body_length), == true);
+    ulfius_clean_response(&response);
+    ulfius_clean_request(&request);
+
+    for (int i = 1; i < ci->len; i++)
+        if (ci->ch[i - 1].ms > ci->ch[i].ms)
+        {
+            // master lists are sorted per server, sort only when mixed
+            qsort(ci->ch, ci->len, sizeof(ci->ch[0]), compare_chunk);
+            break;
+        }
+    return status;
+}
+
+bool chunk_prefetch_get(chunk_index_t *ci, char *day, uint32_t camid)
+{
+    // copy prefetched chunk list of mat camera
+    bool ok = false;
+
+    CAZ(pthread_mutex_lock(&stream.prefetch_mutex));
+    for (int i = 0; i < MAX_CAM; i++)
+        if (stream.prefetch[i].camid == camid && !strcmp(stream.prefetch[i].day, day) && stream.prefetch[i].ci.len)
+        {
+            chunk_reserve(ci, stream.prefetch[i].ci.len);
+            memcpy(ci->ch, stream.prefetch[i].ci.ch, sizeof(chunk_t) * stream.prefetch[i].ci.len);
+            ci->len = stream.prefetch[i].ci.len;
+            chunk_slots(ci);
+            ok = true;
+            break;
+        }
+    CAZ(pthread_mutex_unlock(&stream.prefetch_mutex));
+    return ok;
+}
+
+static uint64_t chunk_cache_get(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    while (bytes--)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+static uint8_t *chunk_cache_put(uint8_t *p, uint64_t v, int bytes)
+{
+    while (bytes--)
+        *p++ = v, v >>= 8;
+    return p;
+}
+
+bool chunk_cache_load(chunk_index_t *ci, char *day, uint32_t camid)
+{
+    // finished day index (sorted chunks) saved by chunk_cache_save
+    char fn[256];
+    struct stat st;
+    uint8_t *b;
+    bool ok = false;
+
+    snprintf(fn, sizeof(fn) - 1, CHUNK_CACHE_FILE, stream.path, day, camid);
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (!fstat(fd, &st) && st.st_size > CHUNK_CACHE_HEAD && (b = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+        uint32_t len = chunk_cache_get(b + 4, 4);
+        if (chunk_cache_get(b, 4) == CHUNK_CACHE_MAGIC && len && st.st_size == CHUNK_CACHE_HEAD + (off_t)CHUNK_CACHE_ENTRY * len)
+        {
+            chunk_reserve(ci, len);
+            for (uint32_t i = 0; i < len; i++)
+            {
+                const uint8_t *e = b + CHUNK_CACHE_HEAD + CHUNK_CACHE_ENTRY * i;
+                ci->ch[i] = (chunk_t){.ms = chunk_cache_get(e, 8), .srvid = e[8], .frames = e[9]};
+            }
+            ci->len = len;
+
+            // last chunk must still exist (day not deleted)
+            snprintf(fn, sizeof(fn) - 1, "%s/" SRVF "/%s/" CAMF "/%lx.ts", stream.path, ci->ch[len - 1].srvid, day, camid, ci->ch[len - 1].ms);
+            ok = !access(fn, R_OK);
+            if (!ok)
+                ci->len = 0;
+        }
+        CAZ(munmap(b, st.st_size));
+    }
+    close(fd);
+    LOG("L: cache %s %s/" CAMF " %d\n", ok ? "hit" : "invalid", day, camid, ci->len);
+    return ok;
+}
+
+void chunk_cache_save(chunk_index_t *ci, char *day, uint32_t camid)
+{
+    char fn[256], tmp[256 + 4];
+    size_t size = CHUNK_CACHE_HEAD + (size_t)CHUNK_CACHE_ENTRY * ci->len;
+    uint8_t *b, *p;
+
+    snprintf(fn, sizeof(fn) - 1, CHUNK_CACHE_DIR, stream.path);
+    mkdir(fn, 0755);
+    snprintf(fn, sizeof(fn) - 1, CHUNK_CACHE_FILE, stream.path, day, camid);
+    snprintf(tmp, sizeof(tmp) - 1, "%s.tmp", fn);
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+    {
+        ERR("cache %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    CAVNZ(b, malloc(size));
+    p = chunk_cache_put(b, CHUNK_CACHE_MAGIC, 4);
+    p = chunk_cache_put(p, ci->len, 4);
+    for (uint32_t i = 0; i < ci->len; i++)
+    {
+        p = chunk_cache_put(p, ci->ch[i].ms, 8);
+        *p++ = ci->ch[i].srvid;
+        *p++ = ci->ch[i].frames;
+    }
+    bool ok = fwrite(b, size, 1, f) == 1;
+    ok &= !fclose(f);
+    free(b);
+    if (!ok || rename(tmp, fn))
+    {
+        ERR("cache %s: %s\n", fn, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+void chunk_cache_remove(char *day)
+{
+    DIR *dir;
+    struct dirent *de;
+    char dn[256], fn[256 + 256];
+
+    snprintf(dn, sizeof(dn) - 1, CHUNK_CACHE_DIR, stream.path);
+    if (!(dir = opendir(dn)))
+        return;
+    while ((de = readdir(dir)))
+        if (!strncmp(de->d_name, day, strlen(day)) && de->d_name[strlen(day)] == '-')
+        {
+            snprintf(fn, sizeof(fn) - 1, "%s/%s", dn, de->d_name);
+            unlink(fn);
+        }
+    closedir(dir);
+}
+
 // +++ STREAM DECODER
 
 static int read_buffer(void *opaque, uint8_t *buf, int buf_size)
 {
     bd_t *bd = (bd_t *)opaque;
-    buf_size = FFMIN(buf_size, bd->blen);
+    buf_size = FFMIN(buf_size, bd->blen - bd->pos);
     if (!buf_size)
         return AVERROR_EOF;
     alarm(6);
-    memcpy(buf, bd->b, buf_size);
+    memcpy(buf, bd->b + bd->pos, buf_size);
     alarm(0);
-    bd->b += buf_size;
-    bd->blen -= buf_size;
+    bd->pos += buf_size;
     return buf_size;
 }
 
+static int64_t ts_timestamp(const uint8_t *p)
+{
+    return (int64_t)(p[0] & 0x0e) << 29 | p[1] << 22 | (p[2] & 0xfe) << 14 | p[3] << 7 | p[4] >> 1;
+}
+
+static bool ts_keyframe(const uint8_t *p, size_t len)
+{
+    // first picture NAL of access unit is IDR/IRAP
+    for (size_t i = 2; i + 1 < len; i++)
+        if (p[i] == 1 && !p[i - 1] && !p[i - 2])
+        {
+            if (stream.codecpar->codec_id == AV_CODEC_ID_HEVC)
+            {
+                uint8_t t = (p[i + 1] >> 1) & 0x3f;
+                if (t < 32)
+                    return t >= 16 && t <= 21;
+            }
+            else
+            {
+                uint8_t t = p[i + 1] & 0x1f;
+                if (t >= 1 && t <= 5)
+                    return t == 5;
+            }
+        }
+    return false;
+}
+
+static int ts_read_packet(bd_t *bd, AVPacket *pkt)
+{
+    // next video PES of mapped chunk, payload gathered into buffer of previous packet or pooled one
+    int64_t start = -1;
+    size_t len = 0;
+    bool rai = false;
+
+    while (bd->pos + TS_PACKET <= bd->blen)
+    {
+        const uint8_t *p = bd->b + bd->pos, *e = p + TS_PACKET;
+        if (p[0] != 0x47)
+        {
+            bd->pos++; // resync
+            continue;
+        }
+        uint32_t pid = (p[1] & 0x1f) << 8 | p[2];
+        bool pusi = p[1] & 0x40;
+        if (pid != stream.video_pid || (p[1] & 0x80) || !(p[3] & 0x10) || (!pusi && start < 0))
+        {
+            bd->pos += TS_PACKET; // other pid, error, no payload or tail of skipped PES
+            continue;
+        }
+        if (pusi && start >= 0)
+            break; // next PES, read next time
+
+        uint8_t afc = p[3];
+        p += 4;
+        if (afc & 0x20)
+        {
+            // adaptation field
+            if (pusi && p[0] && (p[1] & 0x40))
+                rai = true;
+            p += 1 + p[0];
+        }
+        bd->pos += TS_PACKET;
+        if (p >= e)
+            continue;
+
+        if (pusi)
+        {
+            // PES header
+            if (e - p < 9 || p[0] || p[1] || p[2] != 1 || e - p < 9 + p[8])
+                continue;
+            pkt->pts = pkt->dts = AV_NOPTS_VALUE;
+            if ((p[7] & 0x80) && p[8] >= 5)
+                pkt->pts = pkt->dts = ts_timestamp(p + 9);
+            if ((p[7] & 0xc0) == 0xc0 && p[8] >= 10)
+                pkt->dts = ts_timestamp(p + 14);
+            p += 9 + p[8];
+            start = bd->pos - TS_PACKET;
+            if (!pkt->buf || !av_buffer_is_writable(pkt->buf))
+            {
+                av_buffer_unref(&pkt->buf); // still referenced by decoder
+                CAVNZ(pkt->buf, av_buffer_pool_get(stream.decode_pool));
+            }
+        }
+
+        if (len + (e - p) + AV_INPUT_BUFFER_PADDING_SIZE > pkt->buf->size)
+            CAZ(av_buffer_realloc(&pkt->buf, (len + (e - p) + AV_INPUT_BUFFER_PADDING_SIZE) * 2));
+        memcpy(pkt->buf->data + len, p, e - p);
+        len += e - p;
+    }
+    if (start < 0)
+        return AVERROR_EOF;
+
+    memset(pkt->buf->data + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    pkt->data = pkt->buf->data;
+    pkt->size = len;
+    pkt->pos = start;
+    pkt->stream_index = stream.stream_index;
+    pkt->flags = rai || ts_keyframe(pkt->data, len) ? AV_PKT_FLAG_KEY : 0;
+    return 0;
+}
+
 static enum AVPixelFormat setup_get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *pix_fmts)
 {
     const enum AVPixelFormat *p;
@@ -2128,65 +2580,242 @@ static enum AVPixelFormat setup_get_hw_format(AVCodecContext *ctx, const enum AV
     return AV_PIX_FMT_NONE;
 }
 
+static void swdec_free(void *opaque, uint8_t *data)
+{
+    // pool uninit (geometry change, cleanup) and frame gone, dumb buffer and its framebuffer with it
+    swframe_t *sf = opaque;
+    disp_plane_destroy(stream.vi, sf->fd, sf->size, (uint32_t *)sf->map);
+    free(sf);
+}
+
+static AVBufferRef *swdec_alloc(void *opaque, size_t size)
+{
+    // new pool entry, swdec_mutex held by swdec_get_buffer
+    swframe_t *sf;
+    AVBufferRef *ref;
+
+    CAVNZ(sf, calloc(1, sizeof(swframe_t)));
+    sf->height = stream.swdec_height;
+    disp_plane_create(stream.vi, DRM_FORMAT_NV12, stream.swdec_width, sf->height * 2, 8, &sf->fd, &sf->pitch, &sf->size, (uint32_t **)&sf->map);
+    A(sf->pitch % 64 == 0 && sf->size >= size);
+    CAVNZ(ref, av_buffer_create(sf->map, sf->size, swdec_free, sf, 0));
+    stream.swframes++;
+    if (!(stream.swframes & (stream.swframes - 1)))
+        LOG("swdec frames %d\n", stream.swframes);
+    return ref;
+}
+
+static bool swdec_native(int format)
+{
+    // planes fit dumb buffer, others decoded to own buffers and converted (swdec_convert)
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+static swframe_t *swdec_frame(AVFrame *frame)
+{
+    return (swframe_t *)av_buffer_pool_buffer_get_opaque(frame->buf[0]);
+}
+
+static int swdec_get_buffer(AVCodecContext *ctx, AVFrame *frame, int flags)
+{
+    // decoder planes in pooled dumb buffer, NV12 for display interleaved later (swdec_nv12)
+    int w = frame->width, h = frame->height, align[AV_NUM_DATA_POINTERS];
+    swframe_t *sf;
+
+    if (!swdec_native(frame->format))
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    avcodec_align_dimensions2(ctx, &w, &h, align);
+    w = FFALIGN(w, 64); // pitch / 2 is U/V linesize, aligned for decoder
+    h = (h + 3) & ~3;
+
+    // frame cache, bookmarks, frame threads and references of both decoders, no fixed bound
+    CAZ(pthread_mutex_lock(&stream.swdec_mutex));
+    if (!stream.swdec_pool || stream.swdec_width != w || stream.swdec_height != h)
+    {
+        // geometry changed, old entries freed as their frames go
+        av_buffer_pool_uninit(&stream.swdec_pool);
+        stream.swdec_width = w;
+        stream.swdec_height = h;
+        stream.swframes = 0;
+        CAVNZ(stream.swdec_pool, av_buffer_pool_init2(w * h * 2, NULL, swdec_alloc, NULL));
+    }
+    CAVNZ(frame->buf[0], av_buffer_pool_get(stream.swdec_pool));
+    CAZ(pthread_mutex_unlock(&stream.swdec_mutex));
+
+    sf = swdec_frame(frame);
+    frame->data[0] = sf->map;
+    frame->linesize[0] = sf->pitch;
+    frame->data[1] = sf->map + sf->pitch * h * 3 / 2;
+    frame->linesize[1] = sf->pitch / 2;
+    frame->data[2] = frame->data[1] + sf->pitch / 2 * h / 2;
+    frame->linesize[2] = sf->pitch / 2;
+    return 0;
+}
+
+static uint8_t swdec_sample(AVFrame *src, const AVPixFmtDescriptor *desc, int c, int x, int y)
+{
+    // component c at its (subsampled) position, 8 bits
+    const AVComponentDescriptor *comp = desc->comp + c;
+    const uint8_t *p = src->data[comp->plane] + y * src->linesize[comp->plane] + x * comp->step + comp->offset;
+    uint32_t v = *p;
+
+    if (comp->depth > 8)
+        v = desc->flags & AV_PIX_FMT_FLAG_BE ? p[0] << 8 | p[1] : p[1] << 8 | p[0];
+    v = v >> comp->shift & ((1 << comp->depth) - 1);
+    return comp->depth > 8 ? v >> (comp->depth - 8) : v << (8 - comp->depth);
+}
+
+static void swdec_convert(decoder_t *d)
+{
+    // other pixel format (4:2:2, 4:4:4, high bit depth, gray) sampled into dumb buffer as yuv420p, no color: black
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(d->frame->format);
+    AVFrame *frame = d->frame, *src = d->convert;
+    bool yuv = desc && !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM));
+    bool chroma = yuv && desc->nb_components >= 3;
+
+    if (!src)
+    {
+        LOG("swdec converting %s\n", desc ? desc->name : "?");
+        CAVNZ(src, d->convert = av_frame_alloc());
+    }
+    av_frame_move_ref(src, frame);
+    CAZP(av_frame_copy_props(frame, src));
+    frame->width = src->width;
+    frame->height = src->height;
+    frame->format = AV_PIX_FMT_YUV420P;
+    CAZ(swdec_get_buffer(d->ctx, frame, 0));
+
+    for (int y = 0; y < frame->height; y++)
+        for (int x = 0; x < frame->width; x++)
+            frame->data[0][y * frame->linesize[0] + x] = yuv ? swdec_sample(src, desc, 0, x, y) : 16;
+    for (int y = 0; y < frame->height / 2; y++)
+        for (int x = 0; x < frame->width / 2; x++)
+        {
+            int cx = 2 * x >> (chroma ? desc->log2_chroma_w : 0), cy = 2 * y >> (chroma ? desc->log2_chroma_h : 0);
+            frame->data[1][y * frame->linesize[1] + x] = chroma ? swdec_sample(src, desc, 1, cx, cy) : 128;
+            frame->data[2][y * frame->linesize[2] + x] = chroma ? swdec_sample(src, desc, 2, cx, cy) : 128;
+        }
+    av_frame_unref(src);
+}
+
+static void swdec_nv12(decoder_t *d)
+{
+    // interleave decoded U/V into NV12 UV plane (decoder never reads it)
+    if (!swdec_native(d->frame->format))
+        swdec_convert(d);
+    AVFrame *frame = d->frame;
+    swframe_t *sf = swdec_frame(frame);
+    uint8_t *uv = sf->map + sf->pitch * sf->height;
+
+    for (int y = 0; y < frame->height / 2; y++, uv += sf->pitch)
+    {
+        const uint8_t *u = frame->data[1] + y * frame->linesize[1], *v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < frame->width / 2; x++)
+        {
+            uv[2 * x] = u[x];
+            uv[2 * x + 1] = v[x];
+        }
+    }
+}
+
+static int stream_frame_fd(AVFrame *frame)
+{
+    if (stream.swdec)
+        return swdec_frame(frame)->fd;
+    return ((AVDRMFrameDescriptor *)frame->data[0])->objects[0].fd;
+}
+
+static uint32_t stream_frame_bytes(AVFrame *frame)
+{
+    if (stream.swdec)
+        return swdec_frame(frame)->size;
+    return ((AVDRMFrameDescriptor *)frame->data[0])->objects[0].size;
+}
+
 void stream_setup(uint8_t *bf, int bflen)
 {
 
     AVIOContext *avio_ctx = NULL;
     uint8_t *avio_ctx_buffer = NULL;
     AVFormatContext *input_ctx = NULL;
-    const AVCodec *decoder = NULL;
-
-    stream.decode_bd.b = bf;
-    stream.decode_bd.blen = FFMIN(4 * 1024, bflen);
+    bd_t bd = {bf, FFMIN(4 * 1024, bflen), 0};
 
     CAVNZ(input_ctx, avformat_alloc_context());
     CAVNZ(avio_ctx_buffer, av_malloc(4 * 1024));
-    CAVNZ(avio_ctx, avio_alloc_context(avio_ctx_buffer, 4 * 1024, 0, &stream.decode_bd, &read_buffer, NULL, NULL));
+    CAVNZ(avio_ctx, avio_alloc_context(avio_ctx_buffer, 4 * 1024, 0, &bd, &read_buffer, NULL, NULL));
     input_ctx->pb = avio_ctx;
     CAZ(avformat_open_input(&input_ctx, NULL, NULL, NULL));
     CAZ(avformat_find_stream_info(input_ctx, NULL));
     av_dump_format(input_ctx, 0, NULL, 0);
-    CAVZP(stream.stream_index, av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0));
-    CAVNZ(stream.decoder_ctx, avcodec_alloc_context3(decoder));
-    CAZP(avcodec_parameters_to_context(stream.decoder_ctx, input_ctx->streams[stream.stream_index]->codecpar));
+    CAVZP(stream.stream_index, av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &stream.codec, 0));
+    CAVNZ(stream.codecpar, avcodec_parameters_alloc());
+    CAZP(avcodec_parameters_copy(stream.codecpar, input_ctx->streams[stream.stream_index]->codecpar));
+    stream.video_pid = input_ctx->streams[stream.stream_index]->id; // mpegts pid
     stream.width = input_ctx->streams[stream.stream_index]->codecpar->width;
     stream.height = input_ctx->streams[stream.stream_index]->codecpar->height;
-    stream.decoder_ctx->get_format = setup_get_hw_format;
-    CAZP(av_hwdevice_ctx_create(&stream.hw_device_ctx, AV_HWDEVICE_TYPE_DRM, NULL, NULL, 0));
-    stream.decoder_ctx->hw_device_ctx = av_buffer_ref(stream.hw_device_ctx);
-    CAZP(avcodec_open2(stream.decoder_ctx, decoder, NULL));
+    if (STREAM_SWDEC || av_hwdevice_ctx_create(&stream.hw_device_ctx, AV_HWDEVICE_TYPE_DRM, NULL, NULL, 0) < 0)
+    {
+        LOG("software decode\n");
+        stream.swdec = true;
+        CAZ(pthread_mutex_init(&stream.swdec_mutex, NULL));
+    }
     avformat_close_input(&input_ctx);
     av_freep(&avio_ctx->buffer);
     avio_context_free(&avio_ctx);
-
-    stream.decode_bd.b = NULL;
-    stream.decode_bd.blen = 0;
+    CAVNZ(stream.decode_pool, av_buffer_pool_init(STREAM_PES_MAX + AV_INPUT_BUFFER_PADDING_SIZE, NULL));
 }
 
-void stream_cleanup(void)
+void stream_decoder_open(decoder_t *d)
 {
-    if (stream.input_ctx && stream.avio_ctx)
+    // decoder instance for probed stream (stream_setup)
+    CAVNZ(d->ctx, avcodec_alloc_context3(stream.codec));
+    CAZP(avcodec_parameters_to_context(d->ctx, stream.codecpar));
+    if (stream.swdec)
     {
-        avformat_close_input(&stream.input_ctx);
-        av_freep(&stream.avio_ctx->buffer);
-        avio_context_free(&stream.avio_ctx);
-        stream.input_ctx = NULL;
-        stream.avio_ctx = NULL;
-        stream.decode_id = 0;
-        stream.decode_ms = 0;
+        d->ctx->get_buffer2 = swdec_get_buffer;
+        d->ctx->thread_type = FF_THREAD_FRAME;
+        d->ctx->thread_count = 0;
     }
+    else
+    {
+        d->ctx->get_format = setup_get_hw_format;
+        d->ctx->hw_device_ctx = av_buffer_ref(stream.hw_device_ctx);
+    }
+    CAZP(avcodec_open2(d->ctx, stream.codec, NULL));
+    d->ms = 0;
+    d->id = 0;
+}
 
-    avcodec_free_context(&stream.decoder_ctx);
+void stream_cleanup(void)
+{
+    disp_plane_drop_pic(stream.vi, 0); // framebuffers of decoder surface pool
+    avcodec_free_context(&stream.dec.ctx);
+    avcodec_free_context(&stream.rev.ctx);
+    av_frame_free(&stream.dec.frame);
+    av_frame_free(&stream.rev.frame);
+    av_frame_free(&stream.dec.convert);
+    av_frame_free(&stream.rev.convert);
+    av_packet_unref(&stream.dec.packet);
+    av_packet_unref(&stream.rev.packet);
+    while (stream.shellslen)
+        av_frame_free(&stream.shells[--stream.shellslen]);
+    free(stream.shells);
+    stream.shells = NULL;
+    stream.shellssize = 0;
+    free(stream.frm);
+    stream.frm = NULL;
+    stream.frmbits = 0;
+    avcodec_parameters_free(&stream.codecpar);
+    av_buffer_pool_uninit(&stream.decode_pool);
+    av_buffer_pool_uninit(&stream.swdec_pool);
     av_buffer_unref(&stream.hw_device_ctx);
+    chunk_free(&stream.chi);
+    for (int i = 0; i < MAX_CAM; i++)
+        chunk_free(&stream.prefetch[i].ci);
 }
 
 void stream_show_frame(AVFrame *frame)
 {
-    AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *)frame->data[0];
-
-    assert(desc->nb_objects == 1);
-    assert(desc->nb_layers == 1);
-
     if (!stream.display_initialized)
     {
         assert(frame->width == stream.width);
@@ -2195,13 +2824,26 @@ void stream_show_frame(AVFrame *frame)
         uint32_t pitches[DISP_MAX_PLANES], offsets[DISP_MAX_PLANES];
         memset(pitches, 0, sizeof(pitches));
         memset(offsets, 0, sizeof(offsets));
-        for (int j = 0; j < desc->layers[0].nb_planes; j++)
+        if (stream.swdec)
         {
-            offsets[j] = desc->layers[0].planes[j].offset;
-            pitches[j] = desc->layers[0].planes[j].pitch;
+            swframe_t *sf = swdec_frame(frame);
+            pitches[0] = pitches[1] = sf->pitch;
+            offsets[1] = sf->pitch * sf->height;
+            disp_plane_setup(stream.vi, DRM_FORMAT_NV12, stream.width, stream.height, pitches, offsets, 2);
         }
+        else
+        {
+            AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *)frame->data[0];
 
-        disp_plane_setup(stream.vi, desc->layers[0].format, stream.width, stream.height, pitches, offsets, 2);
+            assert(desc->nb_objects == 1);
+            assert(desc->nb_layers == 1);
+            for (int j = 0; j < desc->layers[0].nb_planes; j++)
+            {
+                offsets[j] = desc->layers[0].planes[j].offset;
+                pitches[j] = desc->layers[0].planes[j].pitch;
+            }
+            disp_plane_setup(stream.vi, desc->layers[0].format, stream.width, stream.height, pitches, offsets, 2);
+        }
 
         CAZ(pthread_mutex_lock(&stream.scale_mutex));
         stream.hid_zoom = 0;
@@ -2211,301 +2853,962 @@ void stream_show_frame(AVFrame *frame)
         disp_plane_scale(stream.vi, stream.hid_x, stream.hid_y, stream.hid_w, stream.hid_h, 0, 0, stream.crtc_width, stream.crtc_height);
         stream.display_initialized = true;
     }
-    disp_plane_show_pic(stream.vi, desc->objects[0].fd);
+    disp_plane_show_pic(stream.vi, stream_frame_fd(frame));
 }
 
-bool stream_add_frame(AVFrame *frame, uint64_t ms, uint32_t id)
+static inline uint32_t stream_frame_slot(uint64_t ms, uint32_t id)
 {
-    // mutex held
-    int i;
-    DBG("D: ADD %lu/%d [%d]\n", ms, id, stream.frmlen);
+    return ((ms * STREAM_FRAMES_MAX + id) * 0x9E3779B97F4A7C15ull) >> (64 - stream.frmbits);
+}
 
-    for (i = 0; i < stream.frmlen; i++)
-        if ((ms < stream.frm[i].ms) || (ms == stream.frm[i].ms && id <= stream.frm[i].id))
-        {
-            if (ms == stream.frm[i].ms && id == stream.frm[i].id)
-                return false;
-            break;
-        }
-    memmove(stream.frm + i + 1, stream.frm + i, (stream.frmlen - i) * sizeof(stream.frm[0]));
-    stream.frmlen++;
-    assert(stream.frmlen < DISP_PICTURE_HANDLES);
-    stream.frm[i].id = id;
-    stream.frm[i].ms = ms;
-    stream.frm[i].frame = frame;
+AVFrame *stream_frame_shell()
+{
+    // mutex held
+    AVFrame *frame;
+    if (stream.shellslen)
+        return stream.shells[--stream.shellslen];
+    CAVNZ(frame, av_frame_alloc());
+    return frame;
+}
 
-    return true;
+void stream_frame_release(AVFrame **frame)
+{
+    // mutex held, drop buffers, keep shell
+    av_frame_unref(*frame);
+    if (stream.shellslen < stream.shellssize)
+        stream.shells[stream.shellslen++] = *frame;
+    else
+        av_frame_free(frame);
+    *frame = NULL;
 }
 
-bool stream_remove_frame(uint64_t ms, uint32_t id)
+void stream_bookmark_release()
 {
     // mutex held
-    DBG("D: REM %lu/%d [%d]\n", ms, id, stream.frmlen);
-    if ((ms == stream.show_a_ms && id == stream.show_a_id) || (ms == stream.show_p_ms && id == stream.show_p_id))
-    {
-        // maybe from other stream
-        DBG("D: NOT REM %lu/%d [%d]\n", ms, id, stream.frmlen);
-        return false;
-    }
-    for (int i = 0; i < stream.frmlen; i++)
-        if (ms == stream.frm[i].ms && id == stream.frm[i].id)
-        {
-            disp_plane_drop_pic(stream.vi, ((AVDRMFrameDescriptor *)stream.frm[i].frame->data[0])->objects[0].fd);
-            av_frame_free(&stream.frm[i].frame);
-            memmove(stream.frm + i, stream.frm + i + 1, (stream.frmlen - i - 1) * sizeof(stream.frm[0]));
-            stream.frmlen--;
-            break;
-        }
-    return true;
+    while (stream.bmklen)
+        stream_frame_release(&stream.bmk[--stream.bmklen].frame);
 }
 
-void stream_decode(uint8_t *bf, int bflen, uint64_t ms, uint32_t from, uint32_t to, uint32_t skip)
+void stream_frame_resize(uint32_t frames)
 {
-    uint8_t *avio_ctx_buffer;
-
-    DBG("DECODE %lu/%d-%d enter\n", ms, from, to);
+    // mutex held, index of 2x frames slots (power of 2), entries rehashed, frames not below entries
+    uint32_t bits = FRAMES_CACHE_BITS;
+    while ((1u << bits) < 2 * frames)
+        bits++;
+    if (bits == stream.frmbits)
+        return;
 
-    assert(from <= STREAM_FRAMES && to <= STREAM_FRAMES);
+    frame_cache_t *old = stream.frm;
+    uint32_t oldslots = stream.frmbits ? 1u << stream.frmbits : 0;
+    CAVNZ(stream.frm, calloc(1u << bits, sizeof(frame_cache_t)));
+    stream.frmbits = bits;
+    for (uint32_t i = 0; i < oldslots; i++)
+        if (old[i].ms)
+        {
+            uint32_t j = stream_frame_slot(old[i].ms, old[i].id);
+            while (stream.frm[j].ms)
+                j = (j + 1) & ((1u << bits) - 1);
+            stream.frm[j] = old[i];
+        }
+    free(old);
+    if (oldslots)
+        LOG("frame cache index %u slots\n", 1u << bits);
+}
 
-    uint32_t _from = (from / skip * skip);
-    if (_from < from)
-        _from = ((from / skip + 1) * skip);
-    to = ((to - 1) / skip * skip) + 1;
+frame_cache_t *stream_frame_find(uint64_t ms, uint32_t id)
+{
+    // mutex held, entry or empty slot to insert into
+    if (!stream.frm)
+        stream_frame_resize(0);
+    uint32_t i = stream_frame_slot(ms, id);
+    while (stream.frm[i].ms && (stream.frm[i].ms != ms || stream.frm[i].id != id))
+        i = (i + 1) & ((1u << stream.frmbits) - 1);
+    return stream.frm + i;
+}
 
-    LOG("DECODE %lu/%d-%d\n", ms, from, to);
+bool stream_has_frame(uint64_t ms, uint32_t id)
+{
+    // mutex held
+    return stream_frame_find(ms, id)->ms != 0;
+}
 
-    if (!(ms == stream.decode_ms && stream.decode_id <= from))
+bool stream_frame_step(uint32_t *ck, uint64_t *ms, uint32_t *id, int dir, uint32_t skip)
+{
+    // mutex held, next position in play order, false at the end of index
+    chunk_t *pms = chunk_cursor(&stream.chi, ck, *ms);
+    if (!pms)
+        return false;
+    if (dir > 0)
     {
-        // start/restart decode
-        // DBG("+++\n");
-        if (stream.input_ctx && stream.avio_ctx)
+        if (*id + skip < chunk_frames(pms))
+            *id += skip;
+        else if (pms + 1 - stream.chi.ch < stream.chi.len)
         {
-            avformat_close_input(&stream.input_ctx);
-            av_freep(&stream.avio_ctx->buffer);
-            avio_context_free(&stream.avio_ctx);
-            stream.input_ctx = NULL;
-            stream.avio_ctx = NULL;
+            *id = 0;
+            *ms = pms[1].ms;
+            ++*ck;
         }
-        // DBG("+++\n");
-        assert(stream.stream_initialized);
-
-        stream.decode_bd.b = bf;
-        stream.decode_bd.blen = bflen;
-        stream.decode_ms = ms;
-        stream.decode_read_packet = true;
-        stream.decode_id = 0;
-
-        CAVNZ(stream.input_ctx, avformat_alloc_context());
-        CAVNZ(avio_ctx_buffer, av_malloc(128 * 1024));
-        CAVNZ(stream.avio_ctx, avio_alloc_context(avio_ctx_buffer, 128 * 1024, 0, &stream.decode_bd, &read_buffer, NULL, NULL));
-        stream.input_ctx->pb = stream.avio_ctx;
-        CAZ(avformat_open_input(&stream.input_ctx, NULL, NULL, NULL));
-        // DBG("+++\n");
+        else
+            return false;
     }
-
-    // DBG("+++\n");
-    AVPacket packet = {};
-    while (stream.decode_id < to)
+    else
     {
-        if (stream.decode_read_packet)
+        if (*id >= skip)
+            *id -= skip;
+        else if (pms > stream.chi.ch)
         {
-            if (av_read_frame(stream.input_ctx, &packet) < 0)
-            {
-                av_packet_unref(&packet);
-                break;
+            *id = ((chunk_frames(pms - 1) - 1) / skip) * skip;
+            *ms = pms[-1].ms;
+            --*ck;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+void stream_frame_extend()
+{
+    // mutex held, grow run while its tail is cached
+    while (stream.frm_tail_ms && stream_has_frame(stream.frm_tail_ms, stream.frm_tail_id))
+    {
+        stream.frm_ahead++;
+        if (!stream_frame_step(&stream.frm_tail_ck, &stream.frm_tail_ms, &stream.frm_tail_id, stream.frm_dir, stream.frm_skip))
+            stream.frm_tail_ms = 0;
+    }
+}
+
+void stream_frame_head(uint64_t ms, uint32_t id, int dir, uint32_t skip)
+{
+    // mutex held, playhead moved along the run shortens it, recount only after seek, speed change or at the end of index
+    if (stream.frm_dir == dir && stream.frm_skip == skip && stream.frm_tail_ms)
+    {
+        uint64_t hms = stream.frm_head_ms;
+        uint32_t hid = stream.frm_head_id, ck = stream.frm_ck, n = 0;
+        while (n <= stream.frm_ahead && (hms != ms || hid != id) && stream_frame_step(&ck, &hms, &hid, dir, skip))
+            n++;
+        if (hms == ms && hid == id && n <= stream.frm_ahead)
+        {
+            stream.frm_head_ms = ms;
+            stream.frm_head_id = id;
+            stream.frm_ahead -= n;
+        }
+        else
+            stream.frm_dir = 0;
+    }
+    if (stream.frm_dir != dir || stream.frm_skip != skip || !stream.frm_tail_ms)
+    {
+        stream.frm_dir = dir;
+        stream.frm_skip = skip;
+        stream.frm_head_ms = stream.frm_tail_ms = ms;
+        stream.frm_head_id = stream.frm_tail_id = id;
+        stream.frm_tail_ck = stream.frm_ck;
+        stream.frm_ahead = 0;
+        if (!stream_frame_step(&stream.frm_tail_ck, &stream.frm_tail_ms, &stream.frm_tail_id, dir, skip))
+            stream.frm_tail_ms = 0;
+    }
+    stream_frame_extend();
+}
+
+void stream_frame_budget(uint32_t size)
+{
+    // mutex held, cache depth from byte budget, keep some frames behind for direction reversal
+    uint64_t mem = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / FRAMES_CACHE_MEM_SHARE;
+    stream.frm_size = size;
+    stream.frm_max = FFMAX(FFMIN((uint64_t)FRAMES_CACHE_MB * 1024 * 1024, mem) / size, 8);
+    stream.frm_behind = FFMAX(stream.frm_max / 5, 2);
+    stream.frm_treshold = FFMIN(FRAMES_TRESHOLD, stream.frm_max - stream.frm_behind - 1);
+    stream.frm_reserve = FFMIN(FRAMES_REVERSE_RESERVE, stream.frm_max / 2);
+
+    // index, shells of cached, bookmark and decoder frames, framebuffers of them
+    uint32_t frames = stream.frm_max + BOOKMARK_PRELOAD * BOOKMARK_FRAMES;
+    stream_frame_resize(FFMAX(stream.frm_max, stream.frmlen));
+    if (stream.shellssize < frames + 2)
+    {
+        stream.shellssize = frames + 2;
+        CAVNZ(stream.shells, realloc(stream.shells, stream.shellssize * sizeof(AVFrame *)));
+    }
+    disp_plane_reserve(stream.vi, frames);
+    LOG("frame cache %u bytes/frame, %u frames, %u behind\n", size, stream.frm_max, stream.frm_behind);
+}
+
+int64_t stream_frame_distance(uint64_t ms, uint32_t id)
+{
+    // mutex held, frames from playhead in play direction, frames behind weighted by their share
+    int64_t d = ((int64_t)(ms - stream.show_ms) + ((int64_t)id - stream.show_id) * STREAM_FPS_MSEC) / STREAM_FPS_MSEC;
+    if (stream.speed < 0)
+        d = -d;
+    return d >= 0 ? d : -d * stream.frm_max / stream.frm_behind;
+}
+
+bool stream_frame_queued(uint64_t ms, uint32_t id)
+{
+    // mutex held, frames queued for show or still on screen
+    for (uint32_t i = __atomic_load_n(&stream.showq_tail, __ATOMIC_ACQUIRE); i != stream.showq_head; i++)
+        if (stream.showq[i % SHOW_QUEUE].ms == ms && stream.showq[i % SHOW_QUEUE].id == id)
+            return true;
+    return false;
+}
+
+bool stream_remove_frame(uint64_t ms, uint32_t id)
+{
+    // mutex held, run frames are kept by stream_frame_evict
+    DBG("D: REM %lu/%d [%d]\n", ms, id, stream.frmlen);
+    if (stream_frame_queued(ms, id))
+    {
+        // maybe from other stream
+        DBG("D: NOT REM %lu/%d [%d]\n", ms, id, stream.frmlen);
+        return false;
+    }
+    frame_cache_t *f = stream_frame_find(ms, id);
+    if (!f->ms)
+        return true;
+    disp_plane_drop_pic(stream.vi, stream_frame_fd(f->frame));
+    stream_frame_release(&f->frame);
+    stream.frmlen--;
+
+    // backward shift, keeps probe chains without tombstones
+    uint32_t i = f - stream.frm, j = i;
+    while (stream.frm[j = (j + 1) & ((1u << stream.frmbits) - 1)].ms)
+    {
+        uint32_t k = stream_frame_slot(stream.frm[j].ms, stream.frm[j].id);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        stream.frm[i] = stream.frm[j];
+        i = j;
+    }
+    stream.frm[i].ms = 0;
+    stream.frm[i].frame = NULL;
+    return true;
+}
+
+bool stream_frame_victim(uint64_t ms, uint32_t id)
+{
+    // mutex held, cache full: drop farthest frame behind playhead or last frame of run, if farther than new one
+    uint64_t vms[2] = {}, cms = stream.frm_head_ms;
+    uint32_t vid[2], vck = 0, cid = stream.frm_head_id, ck = stream.frm_ck;
+
+    for (uint32_t j = 0; j < stream.frm_behind && stream_frame_step(&ck, &cms, &cid, -stream.frm_dir, stream.frm_skip) && stream_has_frame(cms, cid); j++)
+        vms[0] = cms, vid[0] = cid;
+    if (stream.frm_ahead)
+    {
+        // one before first missing, walk from playhead only when run reaches end of index
+        cms = stream.frm_tail_ms, cid = stream.frm_tail_id, vck = stream.frm_tail_ck;
+        if (cms)
+            stream_frame_step(&vck, &cms, &cid, -stream.frm_dir, stream.frm_skip);
+        else
+        {
+            cms = stream.frm_head_ms, cid = stream.frm_head_id, vck = stream.frm_ck;
+            for (uint32_t j = 0; j < stream.frm_ahead; j++)
+                stream_frame_step(&vck, &cms, &cid, stream.frm_dir, stream.frm_skip);
+        }
+        vms[1] = cms, vid[1] = cid;
+    }
+
+    int v = -1;
+    int64_t dist = stream_frame_distance(ms, id);
+    for (int i = 0; i < 2; i++)
+        if (vms[i] && stream_frame_distance(vms[i], vid[i]) > dist && !stream_frame_queued(vms[i], vid[i]))
+            v = i, dist = stream_frame_distance(vms[i], vid[i]);
+    if (v < 0)
+        return false;
+    CA(stream_remove_frame(vms[v], vid[v]), == true);
+    stream.frm_evicts++;
+    if (v)
+    {
+        // run shortened by its last frame
+        stream.frm_ahead--;
+        stream.frm_tail_ms = vms[1];
+        stream.frm_tail_id = vid[1];
+        stream.frm_tail_ck = vck;
+    }
+    return true;
+}
+
+bool stream_add_frame(AVFrame *frame, uint64_t ms, uint32_t id, uint64_t msec)
+{
+    // mutex held
+    DBG("D: ADD %lu/%d [%d]\n", ms, id, stream.frmlen);
+
+    if (stream_has_frame(ms, id))
+        return false;
+    if (stream_frame_bytes(frame) != stream.frm_size)
+        stream_frame_budget(stream_frame_bytes(frame));
+    if (stream.bmklen && stream.gui != GUI_BOOKMARKS && stream.frmlen + stream.bmklen >= stream.frm_max)
+        stream_bookmark_release(); // overlay closed meanwhile
+    if (stream.frmlen + stream.bmklen >= stream.frm_max && !stream.frm_dir)
+    {
+        // full after flush, count run from playhead once decoded, else from this frame (reverse decode adds farthest first)
+        uint64_t hms;
+        uint32_t hid;
+        stream_show_playhead(&hms, &hid);
+        if (!hms || !stream_has_frame(hms, hid))
+            hms = ms, hid = id;
+        if (!chunk_cursor(&stream.chi, &stream.frm_ck, hms))
+            return false;
+        stream_frame_head(hms, hid, stream.speed < 0 ? -1 : 1, stream.show_skip);
+    }
+    while (stream.frmlen + stream.bmklen >= stream.frm_max)
+        if (!stream_frame_victim(ms, id))
+            return false;
+
+    frame_cache_t *f = stream_frame_find(ms, id);
+    stream.frmlen++;
+    stream.frm_adds++;
+    assert(stream.frmlen <= stream.frm_max);
+    f->id = id;
+    f->ms = ms;
+    f->mark = stream.frm_mark;
+    f->frame = frame;
+    f->msec = msec;
+
+    if (stream.frm_dir && ms == stream.frm_tail_ms && id == stream.frm_tail_id)
+        stream_frame_extend();
+    return true;
+}
+
+bool stream_bookmark_add(AVFrame *frame, uint64_t ms, uint32_t id, uint64_t msec)
+{
+    // mutex held
+    if (stream.bmklen == BOOKMARK_PRELOAD * BOOKMARK_FRAMES || stream_has_frame(ms, id))
+        return false;
+    for (int i = 0; i < stream.bmklen; i++)
+        if (stream.bmk[i].ms == ms && stream.bmk[i].id == id)
+            return false;
+    stream.bmk[stream.bmklen++] = (frame_cache_t){ms, id, 0, frame, msec};
+    return true;
+}
+
+void stream_bookmark_take(uint64_t ms, uint32_t id)
+{
+    // mutex held, move pre-decoded frames of seek target to frame cache
+    for (int i = 0; i < stream.bmklen;)
+        if (stream.bmk[i].ms == ms && stream.bmk[i].id >= id && stream.bmk[i].id < id + BOOKMARK_FRAMES)
+        {
+            frame_cache_t b = stream.bmk[i];
+            stream.bmk[i] = stream.bmk[--stream.bmklen];
+            if (!stream_add_frame(b.frame, b.ms, b.id, b.msec))
+                stream_frame_release(&b.frame);
+        }
+        else
+            i++;
+}
+
+uint32_t stream_frame_sweep(uint32_t mark)
+{
+    // mutex held, drop unmarked, removal shifts next entry into the same slot
+    uint32_t n = 0;
+    for (uint32_t i = 0; stream.frm && i < 1u << stream.frmbits;)
+        if (!stream.frm[i].ms || stream.frm[i].mark == mark || !stream_remove_frame(stream.frm[i].ms, stream.frm[i].id))
+            i++;
+        else if (n++, !stream.frm[i].ms)
+            i++;
+    return n;
+}
+
+void stream_frame_flush()
+{
+    // mutex held
+    stream_frame_sweep(++stream.frm_mark);
+    stream.frm_dir = 0;
+}
+
+void stream_frame_evict()
+{
+    // mutex held, keep playhead, run ahead and few frames behind in play order
+    uint64_t ms = stream.frm_head_ms;
+    uint32_t id = stream.frm_head_id, ck = stream.frm_ck, behind = 0;
+    while (behind < stream.frm_behind && stream_frame_step(&ck, &ms, &id, -stream.frm_dir, stream.frm_skip) && stream_has_frame(ms, id))
+        behind++;
+    if (stream.frmlen <= 1 + stream.frm_ahead + behind)
+        return; // nothing stale
+
+    uint32_t mark = ++stream.frm_mark;
+    ms = stream.frm_head_ms, id = stream.frm_head_id, ck = stream.frm_ck;
+    stream_frame_find(ms, id)->mark = mark;
+    for (uint32_t j = 0; j < behind && stream_frame_step(&ck, &ms, &id, -stream.frm_dir, stream.frm_skip); j++)
+        stream_frame_find(ms, id)->mark = mark;
+    ms = stream.frm_head_ms, id = stream.frm_head_id, ck = stream.frm_ck;
+    for (uint32_t j = 0; j < stream.frm_ahead && stream_frame_step(&ck, &ms, &id, stream.frm_dir, stream.frm_skip); j++)
+        stream_frame_find(ms, id)->mark = mark;
+    stream.frm_evicts += stream_frame_sweep(mark);
+}
+
+void stream_unmap(decoder_t *d)
+{
+    if (d->map_ms)
+    {
+        CAZ(munmap(d->map.b, d->map.blen));
+        close(d->map_fd);
+        d->map_ms = 0;
+    }
+}
+
+gop_t *stream_gop(decoder_t *d, uint64_t ms)
+{
+    // keyframe index of mapped chunk, built by demuxing it once
+    AVPacket *packet = &d->packet;
+    bd_t bd = d->map;
+    gop_t *gop;
+    uint32_t id = 0;
+
+    for (int i = 0; i < STREAM_GOP_CACHE; i++)
+        if (d->gop[i].ms == ms)
+        {
+            gop = &d->gop[i];
+            goto learned;
+        }
+
+    struct timespec a_ts, b_ts;
+    clock_gettime(CLOCK_MONOTONIC, &a_ts);
+    gop = &d->gop[d->gopnext++ % STREAM_GOP_CACHE];
+    gop->ms = ms;
+    gop->len = 0;
+    bd.pos = 0;
+    int64_t pts0 = AV_NOPTS_VALUE;
+    while (id < STREAM_FRAMES_MAX && ts_read_packet(&bd, packet) >= 0)
+    {
+        // one packet per frame, no reordering
+        if (packet->flags & AV_PKT_FLAG_KEY)
+        {
+            gop->key[gop->len].pos = packet->pos;
+            gop->key[gop->len].id = id;
+            gop->len++;
+        }
+        // 90 kHz, 33 bit wrap
+        if (packet->pts != AV_NOPTS_VALUE && pts0 == AV_NOPTS_VALUE)
+            pts0 = packet->pts;
+        if (packet->pts != AV_NOPTS_VALUE)
+            gop->msec[id] = ((packet->pts - pts0) & ((1ll << 33) - 1)) / 90;
+        else
+            gop->msec[id] = id ? gop->msec[id - 1] + STREAM_FPS_MSEC : 0;
+        id++;
+    }
+    gop->frames = id ? id : 1;
+    DBG("D: gop %lu keys %d frames %d\n", ms, gop->len, id);
+    clock_gettime(CLOCK_MONOTONIC, &b_ts);
+    __atomic_add_fetch(&stream.gop_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stream.gop_ns, (b_ts.tv_sec - a_ts.tv_sec) * NS_IN_SEC + b_ts.tv_nsec - a_ts.tv_nsec, __ATOMIC_RELAXED);
+
+learned:
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    chunk_t *ck = chunk_get(&stream.chi, ms);
+    if (ck)
+        ck->frames = gop->frames;
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    return gop;
+}
+
+bool stream_decode_keys(decoder_t *d, uint64_t ms, uint32_t from, uint32_t to, uint32_t skip)
+{
+    // trick play, all wanted frames are keyframes: decode them alone
+    gop_t *gop = stream_gop(d, ms);
+    uint32_t id, k;
+
+    for (id = from, k = 0; id < to; id += skip)
+    {
+        while (k < gop->len && gop->key[k].id < id)
+            k++;
+        if (k == gop->len || gop->key[k].id != id)
+            return false;
+    }
+
+    // previous stream_decode may leave frames pending (threads, hw latency), send would EAGAIN or drain stale frame
+    if (d->ms)
+    {
+        avcodec_flush_buffers(d->ctx);
+        d->ms = 0;
+    }
+
+    for (id = from, k = 0; id < to; id += skip)
+    {
+        bd_t bd = d->map;
+
+        while (gop->key[k].id < id)
+            k++;
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        bool have = stream_has_frame(ms, id);
+        if (!d->frame)
+            d->frame = stream_frame_shell();
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        if (have)
+            continue;
+
+        DBG("D: key %lu/%d\n", ms, id);
+        bd.pos = gop->key[k].pos;
+        CAZP(ts_read_packet(&bd, &d->packet));
+        CAZ(avcodec_send_packet(d->ctx, &d->packet));
+        CAZ(avcodec_send_packet(d->ctx, NULL)); // drain
+        if (!avcodec_receive_frame(d->ctx, d->frame))
+        {
+            if (stream.swdec)
+                swdec_nv12(d);
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            if (stream_add_frame(d->frame, ms, id, ms + gop->msec[id]))
+                d->frame = stream_frame_shell();
+            else
+                av_frame_unref(d->frame);
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        }
+        avcodec_flush_buffers(d->ctx);
+    }
+
+    d->ms = 0; // decoder flushed, restart next time
+    return true;
+}
+
+void stream_decode(decoder_t *d, uint64_t ms, uint32_t from, uint32_t to, uint32_t skip)
+{
+    gop_t *gop;
+
+    DBG("DECODE %lu/%d-%d enter\n", ms, from, to);
+
+    assert(d->map_ms == ms);
+    gop = stream_gop(d, ms);
+    to = FFMIN(to, gop->frames);
+    if (from >= to)
+        return;
+
+    uint32_t _from = (from / skip * skip);
+    if (_from < from)
+        _from = ((from / skip + 1) * skip);
+    to = ((to - 1) / skip * skip) + 1;
+
+    LOG("DECODE %lu/%d-%d\n", ms, from, to);
+
+    if (skip > 1 && stream_decode_keys(d, ms, _from, to, skip))
+        return;
+    // trick play, skip deblocking (artifacts do not stay long at high speed)
+    d->ctx->skip_loop_filter = skip > 1 ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+
+    if (!(ms == d->ms && d->id <= from))
+    {
+        // start/restart decode
+        assert(stream.stream_initialized);
+
+        d->bd = d->map;
+        d->bd.pos = 0;
+        d->ms = ms;
+        d->read_packet = true;
+        d->id = 0;
+        avcodec_flush_buffers(d->ctx);
+    }
+
+    // skip to nearest keyframe at or before first wanted frame
+    for (int i = gop->len - 1; i >= 0; i--)
+        if (gop->key[i].id <= _from)
+        {
+            if (gop->key[i].id > d->id)
+            {
+                DBG("D: seek %lu/%d -> %d\n", ms, d->id, gop->key[i].id);
+                avcodec_flush_buffers(d->ctx);
+                d->bd.pos = gop->key[i].pos;
+                d->id = gop->key[i].id;
+                d->read_packet = true;
             }
+            break;
         }
-        if (!stream.decode_read_packet || stream.stream_index == packet.stream_index)
+
+    if (!d->frame)
+    {
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        d->frame = stream_frame_shell();
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    }
+
+    // DBG("+++\n");
+    while (d->id < to)
+    {
+        if (d->read_packet)
+        {
+            if (ts_read_packet(&d->bd, &d->packet) < 0)
+                break;
+        }
+        if (!d->read_packet || stream.stream_index == d->packet.stream_index)
         {
             // DBG("+++\n");
 
-            if (stream.decode_read_packet)
-                CAZ(avcodec_send_packet(stream.decoder_ctx, &packet));
-            stream.decode_read_packet = false;
-            while (stream.decode_id < to)
+            if (d->read_packet)
+                CAZ(avcodec_send_packet(d->ctx, &d->packet));
+            d->read_packet = false;
+            while (d->id < to)
             {
                 // DBG("+++\n");
-                AVFrame *frame = NULL;
-                CAVNZ(frame, av_frame_alloc());
-                int ret = avcodec_receive_frame(stream.decoder_ctx, frame);
+                int ret = avcodec_receive_frame(d->ctx, d->frame);
                 if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                 {
                     // DBG("+++\n");
-                    av_frame_free(&frame);
-                    stream.decode_read_packet = true;
+                    d->read_packet = true;
                     break;
                 }
                 assert(!ret);
-                assert(frame->format == AV_PIX_FMT_DRM_PRIME);
-                if (stream.decode_id >= from && (stream.decode_id % skip == 0))
+                assert(stream.swdec || d->frame->format == AV_PIX_FMT_DRM_PRIME);
+                if (d->id >= from && (d->id % skip == 0))
                 {
+                    if (stream.swdec)
+                        swdec_nv12(d);
                     // DBG("+++\n");
                     CAZ(pthread_mutex_lock(&stream.decoder_mutex));
-                    if (!stream_add_frame(frame, ms, stream.decode_id))
-                        av_frame_free(&frame);
+                    bool kept;
+                    if (d->side)
+                        kept = stream_bookmark_add(d->frame, ms, d->id, ms + gop->msec[d->id]);
+                    else
+                        kept = !(d == &stream.rev && stream.frmlen + stream.frm_reserve >= stream.frm_max) && stream_add_frame(d->frame, ms, d->id, ms + gop->msec[d->id]);
+                    if (kept)
+                        d->frame = stream_frame_shell(); // handed over to cache
+                    else
+                        av_frame_unref(d->frame);
                     CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
                     // DBG("+++\n");
                 }
                 else
-                    av_frame_free(&frame);
-                stream.decode_id++;
+                    av_frame_unref(d->frame);
+                d->id++;
             }
         }
         // DBG("+++\n");
-        av_packet_unref(&packet);
     }
 }
 
-int compare_chunk(const void *a, const void *b)
-{
-    if (((const chunk_t *)a)->ms < ((const chunk_t *)b)->ms)
-        return -1;
-    if (((const chunk_t *)a)->ms > ((const chunk_t *)b)->ms)
-        return 1;
-    return 0;
-}
-
-void stream_map(uint64_t ms)
+void stream_map(decoder_t *d, uint64_t ms)
 {
     char fn[256];
 
-    if (stream.decoder_loader_ms == ms)
+    if (d->map_ms == ms)
         return;
-    if (stream.decoder_loader_ms)
-    {
-        CAZ(munmap(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen));
-        close(stream.decoder_loader_fd);
-    }
+    stream_unmap(d);
 
-    stream.decoder_loader_ms = ms;
-    chunk_t _ms = {ms, 0};
-    chunk_t *ck = bsearch(&_ms, stream.ch, stream.chlen, sizeof(stream.ch[0]), compare_chunk);
+    d->map_ms = ms;
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    chunk_t *ck = chunk_get(&stream.chi, ms);
     A(ck);
-    snprintf(fn, sizeof(fn) - 1, "%s/" SRVF "/%s/" CAMF "/%lx.ts", stream.path, ck->srvid, stream.day, stream.camid, ms);
+    uint8_t srvid = ck->srvid;
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    snprintf(fn, sizeof(fn) - 1, "%s/" SRVF "/%s/" CAMF "/%lx.ts", stream.path, srvid, stream.day, stream.camid, ms);
     LOG("L: loading %s\n", fn);
 
+    struct timespec a_ts, b_ts;
+    clock_gettime(CLOCK_MONOTONIC, &a_ts);
     alarm(6);
-    CAVZP(stream.decoder_loader_fd, open(fn, O_RDONLY));
-    CAVP(stream.decoder_loader_bd.blen, lseek(stream.decoder_loader_fd, 0, SEEK_END));
-    CAV(stream.decoder_loader_bd.b, mmap(NULL, stream.decoder_loader_bd.blen, PROT_READ, MAP_PRIVATE, stream.decoder_loader_fd, 0), != MAP_FAILED);
+    CAVZP(d->map_fd, open(fn, O_RDONLY));
+    CAVP(d->map.blen, lseek(d->map_fd, 0, SEEK_END));
+    CAV(d->map.b, mmap(NULL, d->map.blen, PROT_READ, MAP_PRIVATE, d->map_fd, 0), != MAP_FAILED);
+    // fault in whole chunk here, demuxer reads mapping without alarm
+    for (size_t i = 0; i < d->map.blen; i += 4096)
+        (void)((volatile uint8_t *)d->map.b)[i];
     alarm(0);
+    clock_gettime(CLOCK_MONOTONIC, &b_ts);
+    __atomic_add_fetch(&stream.open_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stream.open_ns, (b_ts.tv_sec - a_ts.tv_sec) * NS_IN_SEC + b_ts.tv_nsec - a_ts.tv_nsec, __ATOMIC_RELAXED);
 }
 
-static void *stream_decoder_thread(void *data)
+void stream_decoder_wake()
 {
-    uint64_t prev_ms;
-    int prev_id;
+    // mutex held
+    stream.decoder_wake = true;
+    CAZ(pthread_cond_broadcast(&stream.decoder_cond));
+}
 
-    LOG("DECODER THREAD START\n");
-    DBG("D: frmlen %d\n", stream.frmlen);
+void stream_reverse(uint64_t ms, int id, int count, uint32_t skip)
+{
+    // backward from id, GOP aligned segments, next older segment goes to reverse thread
+    uint64_t next_ms = 0;
+    uint32_t next_to = 0;
 
     CAZ(pthread_mutex_lock(&stream.decoder_mutex));
-    prev_ms = stream.show_ms;
-    prev_id = stream.show_id;
+    while (stream.reverse_busy && !stream.stopping && !stream.switching)
+        CAZ(pthread_cond_wait(&stream.decoder_cond, &stream.decoder_mutex));
+    // skip frames done by reverse thread
+    while (count > 0 && stream_has_frame(ms, id / skip * skip))
+    {
+        id = id / skip * skip - skip;
+        count -= skip;
+        if (id < 0)
+        {
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+            ms = chunk_step(ms, -1);
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            if (!ms)
+                break;
+            chunk_t *ck = chunk_get(&stream.chi, ms);
+            id = (ck ? chunk_frames(ck) : STREAM_FRAMES) - 1;
+        }
+    }
     CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
 
-    while (!stream.stopping && !stream.switching)
+    while (ms && count > 0)
     {
-        int count = 0;              // frames
-        int prev_count, next_count; // frm
-        uint64_t ms;
-        int id;
-        int frmidx;
+        stream_map(&stream.dec, ms);
+        gop_t *gop = stream_gop(&stream.dec, ms);
+        id = FFMIN(id, (int)gop->frames - 1);
+        int target = id + 1 - count, from = 0;
+
+        if (target > 0)
+        {
+            // whole GOP tail if keyframe is close, otherwise decoded frames before target are dropped
+            for (int i = gop->len - 1; i >= 0; i--)
+                if (gop->key[i].id <= target)
+                {
+                    from = target - gop->key[i].id < count / 2 ? gop->key[i].id : target;
+                    break;
+                }
+        }
+        stream_decode(&stream.dec, ms, from, id + 1, skip);
+        count -= id + 1 - from;
 
+        next_ms = ms;
+        next_to = from;
+        if (!from)
+        {
+            next_ms = chunk_step(ms, -1);
+            next_to = STREAM_FRAMES_MAX; // chunk end
+            if (count < FRAMES_PRELOAD)
+                break; // minimum load
+            id = STREAM_FRAMES_MAX - 1;
+            ms = next_ms;
+            next_ms = 0;
+        }
+    }
+
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    if (next_ms && !stream.reverse_busy && stream.frmlen + stream.frm_reserve < stream.frm_max)
+    {
+        chunk_t *ck = chunk_get(&stream.chi, next_ms);
+        if (next_to == STREAM_FRAMES_MAX)
+            next_to = ck ? chunk_frames(ck) : STREAM_FRAMES;
+        stream.reverse_ms = next_ms;
+        stream.reverse_to = next_to;
+        stream.reverse_from = next_to > FRAMES_PRELOAD * skip ? next_to - FRAMES_PRELOAD * skip : 0;
+        stream.reverse_skip = skip;
+        CAZ(pthread_cond_signal(&stream.reverse_cond));
+    }
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+}
+
+void stream_bookmark_preload()
+{
+    // first frames of visible bookmarks to side cache, reverse requests take over
+    time_t bookmarks[BOOKMARK_PRELOAD];
+    int len;
+
+    CAZ(pthread_mutex_lock(&stream.info_mutex));
+    len = FFMIN(stream.info_bookmarkslen, BOOKMARK_PRELOAD);
+    memcpy(bookmarks, stream.info_bookmarks, sizeof(bookmarks[0]) * len);
+    CAZ(pthread_mutex_unlock(&stream.info_mutex));
+
+    if (!stream.rev.ctx)
+        stream_decoder_open(&stream.rev);
+    for (int i = 0; i < len && stream.gui == GUI_BOOKMARKS && !stream.stopping && !stream.switching; i++)
+    {
+        uint64_t msec = bookmarks[i] * 1000, ms;
+        uint32_t id;
+
+        // same target as show thread seek
         CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        chunk_t *lms = chunk_find(&stream.chi, msec);
+        bool busy = stream.reverse_ms || stream.frmlen + stream.bmklen + BOOKMARK_FRAMES > stream.frm_max;
+        ms = lms ? lms->ms : 0;
+        id = lms ? chunk_id(&stream.chi, lms, msec) : 0;
+        bool have = stream_has_frame(ms, id);
+        for (int j = 0; j < stream.bmklen; j++)
+            have |= stream.bmk[j].ms == ms && stream.bmk[j].id == id;
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        if (busy)
+            break;
+        if (!ms || have)
+            continue;
 
-        while (!stream.stopping && !stream.switching && prev_ms == stream.show_ms && prev_id == stream.show_id && pthread_cond_wait(&stream.decoder_cond, &stream.decoder_mutex))
-            ;
+        DBG("R: bookmark %lu/%d\n", ms, id);
+        stream_map(&stream.rev, ms);
+        stream.rev.side = true;
+        stream_decode(&stream.rev, ms, id, id + BOOKMARK_FRAMES, 1);
+        stream.rev.side = false;
+    }
+}
 
-        if (stream.stopping || stream.switching)
+static void *stream_reverse_thread(void *data)
+{
+    LOG("REVERSE THREAD START\n");
+
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    while (!stream.stopping && !stream.switching)
+    {
+        if (!stream.reverse_ms && stream.bookmark_pending && stream.stream_initialized)
         {
+            stream.bookmark_pending = false;
+            if (stream.gui != GUI_BOOKMARKS)
+            {
+                stream_bookmark_release();
+                continue;
+            }
             CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
-            break;
+            stream_bookmark_preload();
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            continue;
         }
+        if (!stream.reverse_ms)
+        {
+            CAZ(pthread_cond_wait(&stream.reverse_cond, &stream.decoder_mutex));
+            continue;
+        }
+        uint64_t ms = stream.reverse_ms;
+        uint32_t from = stream.reverse_from, to = stream.reverse_to, skip = stream.reverse_skip;
+        stream.reverse_ms = 0;
+        stream.reverse_busy = true;
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
 
-        prev_ms = ms = stream.show_ms;
-        prev_id = id = stream.show_id;
-        uint32_t skip = stream.show_skip;
+        DBG("R: %lu/%d-%d\n", ms, from, to);
+        if (!stream.rev.ctx)
+            stream_decoder_open(&stream.rev);
+        stream_map(&stream.rev, ms);
+        stream_decode(&stream.rev, ms, from, to, skip);
 
-        DBG("D: start request %lu/%d\n", ms, id);
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        stream.reverse_busy = false;
+        stream_decoder_wake(); // queue segment frames
+    }
+    stream.reverse_ms = 0;
+    stream_bookmark_release();
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
 
-        chunk_t *pms = bsearch(&ms, stream.ch, stream.chlen, sizeof(stream.ch[0]), compare_chunk);
-        assert(pms);
+    stream_unmap(&stream.rev);
+    LOG("REVERSE THREAD END\n");
+    return NULL;
+}
 
-        for (frmidx = 0; frmidx < stream.frmlen; frmidx++)
-            if (ms == stream.frm[frmidx].ms && id == stream.frm[frmidx].id)
-                break;
+void stream_show_playhead(uint64_t *ms, uint32_t *id)
+{
+    // mutex held, next frame to show, oldest valid queued or feed cursor
+    for (uint32_t i = __atomic_load_n(&stream.showq_rd, __ATOMIC_ACQUIRE); i != stream.showq_head; i++)
+        if (stream.showq[i % SHOW_QUEUE].gen == stream.showq_gen)
+        {
+            *ms = stream.showq[i % SHOW_QUEUE].ms;
+            *id = stream.showq[i % SHOW_QUEUE].id;
+            return;
+        }
+    *ms = stream.show_ms;
+    *id = stream.show_id;
+}
 
-        // DBG("D: %d\n", stream.frmlen);
+void stream_show_feed()
+{
+    // mutex held, decoder thread queues cached frames in play order, show thread pops them without lock
+    if (stream.show_ms && !chunk_cursor(&stream.chi, &stream.show_ck, stream.show_ms))
+        stream.show_msec_seek = stream.show_msec; // index changed under cursor
 
-        if (frmidx < stream.frmlen)
+    if (stream.show_msec_seek && stream.chi.len)
+    {
+        stream.show_msec = stream.show_msec_seek;
+        stream.show_msec_seek = 0;
+
+        // find nearest low
+        chunk_t *lms = chunk_find(&stream.chi, stream.show_msec);
+        DBG("F:2 %ld %u | %lu %lu\n", lms - stream.chi.ch, stream.chi.len, lms->ms, stream.show_msec);
+
+        stream.show_ck = lms - stream.chi.ch;
+        stream.show_ms = lms->ms;
+        stream.show_id = chunk_id(&stream.chi, lms, stream.show_msec) / stream.show_skip * stream.show_skip;
+        stream.show_queued = false;
+        __atomic_store_n(&stream.showq_gen, stream.showq_gen + 1, __ATOMIC_RELEASE);
+        DBG("F:3 start search %lu/%d ~ %ld\n", stream.show_ms, stream.show_id, stream.show_msec);
+    }
+    else if (stream.show_ms && (stream.speed != stream.showq_speed || stream.show_skip != stream.showq_skip))
+    {
+        // drop queued frames, continue from playhead
+        stream_show_playhead(&stream.show_ms, &stream.show_id);
+        stream.show_id = stream.show_id / stream.show_skip * stream.show_skip;
+        stream.show_queued = false;
+        __atomic_store_n(&stream.showq_gen, stream.showq_gen + 1, __ATOMIC_RELEASE);
+    }
+    stream.showq_speed = stream.speed;
+    stream.showq_skip = stream.show_skip;
+
+    uint32_t tail = __atomic_load_n(&stream.showq_tail, __ATOMIC_ACQUIRE);
+    while (stream.show_ms && stream.showq_head - tail < SHOW_QUEUE)
+    {
+        if (stream.show_queued)
         {
-            // compute treshold
-            int j;
-            prev_count = frmidx, next_count = stream.frmlen - frmidx - 1;
-            int frm_cnt = 0;
+            // stop at either end and wait for new chunk, hold in pause
+            if (!stream.speed || !stream_frame_step(&stream.show_ck, &stream.show_ms, &stream.show_id, stream.speed < 0 ? -1 : 1, stream.show_skip))
+                break;
+            stream.show_queued = false;
+        }
+        if (stream.bmklen && !stream_has_frame(stream.show_ms, stream.show_id))
+            stream_bookmark_take(stream.show_ms, stream.show_id);
+        frame_cache_t *f = stream_frame_find(stream.show_ms, stream.show_id);
+        if (!f->ms)
+            break;
+        stream.showq[stream.showq_head % SHOW_QUEUE] = (showq_t){f->ms, f->id, stream.showq_gen, stream.speed, f->frame, f->msec};
+        __atomic_store_n(&stream.showq_head, stream.showq_head + 1, __ATOMIC_RELEASE);
+        stream.show_queued = true;
+    }
+}
 
-            if (stream.speed < 0)
-            {
-                for (j = 0; frmidx - j >= 0; j++)
-                {
-                    if (ms != stream.frm[frmidx - j].ms || id != stream.frm[frmidx - j].id)
-                    {
-                        /// DBG("D:1 %ld/%d exp %ld/%d\n", stream.frm[frmidx-j].ms, stream.frm[frmidx-j].id, ms, id);
-                        if (!stream_remove_frame(stream.frm[frmidx - j].ms, stream.frm[frmidx - j].id))
-                            continue;
-                        frmidx--;
-                        j--;
-                        continue;
-                    }
-                    frm_cnt++;
-                    id -= skip;
-                    if (id < 0)
-                    {
-                        id = ((STREAM_FRAMES - 1) / skip) * skip;
-                        if (pms - stream.ch > 0)
-                            ms = (--pms)->ms;
-                        else
-                        {
-                            ms = 0;
-                            break;
-                        }
-                    }
-                }
-            }
-            else
-            {
-                for (j = 0; frmidx + j < stream.frmlen; j++)
-                {
-                    if (ms != stream.frm[frmidx + j].ms || id != stream.frm[frmidx + j].id)
-                    {
-                        // DBG("D:2 %ld/%d exp %ld/%d\n", stream.frm[frmidx+j].ms, stream.frm[frmidx+j].id, ms, id);
-                        if (!stream_remove_frame(stream.frm[frmidx + j].ms, stream.frm[frmidx + j].id))
-                            continue;
-                        j--;
-                        continue;
-                    }
-                    // DBG("D:3 %ld/%d\n", ms, id);
-                    frm_cnt++;
-                    id += skip;
-                    if (id >= STREAM_FRAMES)
-                    {
-                        id = 0;
-                        if (pms - stream.ch < stream.chlen - 1)
-                            ms = (++pms)->ms;
-                        else
-                        {
-                            ms = 0;
-                            break;
-                        }
-                    }
-                }
-            }
-            // check threshold
-            if (frm_cnt < FRAMES_TRESHOLD)
+void stream_show_refill(uint32_t ahead)
+{
+    // mutex held, queue position where show wakes decoder: run ahead below threshold or queue half empty
+    uint32_t rd = __atomic_load_n(&stream.showq_rd, __ATOMIC_ACQUIRE), queued = stream.showq_head - rd;
+    uint32_t n = FFMIN(ahead + 2 > stream.frm_treshold ? ahead + 2 - stream.frm_treshold : 1, queued > SHOW_QUEUE / 2 ? queued - SHOW_QUEUE / 2 : 1);
+    if (!queued)
+        n = 0; // wake once on empty queue
+    __atomic_store_n(&stream.showq_wake, rd + n, __ATOMIC_RELEASE);
+}
+
+static void *stream_decoder_thread(void *data)
+{
+    LOG("DECODER THREAD START\n");
+    DBG("D: frmlen %d\n", stream.frmlen);
+
+    CAZ(pthread_create(&stream.reverse_tid, NULL, stream_reverse_thread, NULL));
+
+    while (!stream.stopping && !stream.switching)
+    {
+        int count = 0; // frames
+        uint64_t ms;
+        uint32_t id;
+
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+
+        while (!stream.stopping && !stream.switching && !stream.decoder_wake)
+            CAZ(pthread_cond_wait(&stream.decoder_cond, &stream.decoder_mutex));
+
+        if (stream.stopping || stream.switching)
+        {
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+            break;
+        }
+
+        stream.decoder_wake = false;
+        stream_show_feed();
+        if (!stream.show_ms)
+        {
+            // no position yet
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+            continue;
+        }
+        stream_show_playhead(&ms, &id);
+        uint32_t skip = stream.show_skip;
+        uint64_t adds = stream.frm_adds;
+
+        DBG("D: start request %lu/%d\n", ms, id);
+
+        chunk_t *pms;
+        CAVNZ(pms, chunk_cursor(&stream.chi, &stream.frm_ck, ms));
+
+        if (stream_has_frame(ms, id))
+        {
+            stream.frm_hits++;
+            stream_frame_head(ms, id, stream.speed < 0 ? -1 : 1, skip);
+            stream_frame_evict();
+
+            // continue behind run, check threshold
+            ms = stream.frm_tail_ms;
+            id = stream.frm_tail_id;
+            if (1 + stream.frm_ahead < stream.frm_treshold)
                 count = FRAMES_PRELOAD * skip;
             else
                 count = 0;
+            stream_show_refill(stream.frm_ahead);
             // DBG("D:4 %d\n",count);
         }
         else
@@ -2513,48 +3816,9 @@ static void *stream_decoder_thread(void *data)
             // miss actual load
             DBG("D: %ld/%d miss\n", ms, id);
             // restart
-            int frm_cnt = 0;
-            while (stream.frmlen > frm_cnt)
-                if (!stream_remove_frame(stream.frm[stream.frmlen - 1 - frm_cnt].ms, stream.frm[stream.frmlen - 1 - frm_cnt].id))
-                    frm_cnt++;
-            count = (FRAMES_TRESHOLD)*skip;
-            frmidx = prev_count = next_count = 0;
-        }
-
-        // free older frames
-        if (count && ms)
-        {
-            if (stream.speed < 0)
-            {
-                for (int frm_cnt = 0, j = 1; frmidx + j < stream.frmlen; j++)
-                {
-                    if (stream.frm[frmidx + j].id % skip != 0 || frm_cnt > FRAMES_TRESHOLD / 2)
-                    {
-                        DBG("D:5 %ld/%d\n", stream.frm[frmidx + j].ms, stream.frm[frmidx + j].id);
-                        if (!stream_remove_frame(stream.frm[frmidx + j].ms, stream.frm[frmidx + j].id))
-                            continue;
-                        j--;
-                        continue;
-                    }
-                    frm_cnt++;
-                }
-            }
-            else
-            {
-                for (int frm_cnt = 0, j = 1; frmidx - j >= 0; j++)
-                {
-                    if (stream.frm[frmidx + j].id % skip != 0 || frm_cnt > FRAMES_TRESHOLD / 2)
-                    {
-                        DBG("D:6 %ld/%d\n", stream.frm[frmidx - j].ms, stream.frm[frmidx - j].id);
-                        if (!stream_remove_frame(stream.frm[frmidx - j].ms, stream.frm[frmidx - j].id))
-                            continue;
-                        frmidx--;
-                        j--;
-                        continue;
-                    }
-                    frm_cnt++;
-                }
-            }
+            stream.frm_misses++;
+            stream_frame_flush();
+            count = stream.frm_treshold * skip;
         }
 
         CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
@@ -2566,87 +3830,59 @@ static void *stream_decoder_thread(void *data)
         if (count && ms)
         {
             DBG("D:7 LOAD %ld/%d %d %d\n", ms, id, count, stream.speed);
-            stream_map(ms);
+            stream_map(&stream.dec, ms);
             if (!stream.stream_initialized)
             {
-                stream_setup(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen);
-                stream.decode_ms = 0;
-                stream.decode_id = 0;
+                stream_setup(stream.dec.map.b, stream.dec.map.blen);
+                stream_decoder_open(&stream.dec);
                 stream.stream_initialized = true;
             }
 
             if (stream.speed < 0)
-            {
-                while (1)
-                {
-                    if (id - count < 0)
-                    {
-                        stream_decode(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen, ms, 0, id + 1, skip);
-                        count -= id;
-                        if (count < FRAMES_PRELOAD)
-                            break; // minimum load
-                        id = STREAM_FRAMES - 1;
-                        if (pms - stream.ch > 0)
-                        {
-                            ms = (--pms)->ms;
-                            stream_map(ms);
-                        }
-                        else
-                        {
-                            ms = 0;
-                            break;
-                        }
-                    }
-                    else
-                    {
-                        stream_decode(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen, ms, id - count, id + 1, skip);
-                        break;
-                    }
-                }
-            }
+                stream_reverse(ms, id, count, skip);
             else
             {
                 while (1)
                 {
-                    if (id + count > STREAM_FRAMES)
+                    uint32_t frames = stream_gop(&stream.dec, ms)->frames;
+                    if (id + count > frames)
                     {
-                        stream_decode(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen, ms, id, STREAM_FRAMES, skip);
-                        count -= (STREAM_FRAMES - id);
+                        stream_decode(&stream.dec, ms, id, frames, skip);
+                        if (id < frames)
+                            count -= frames - id;
                         id = 0;
-                        if (pms - stream.ch < stream.chlen - 1)
-                        {
-                            ms = (++pms)->ms;
-                            stream_map(ms);
-                        }
+                        if ((ms = chunk_step(ms, 1)))
+                            stream_map(&stream.dec, ms);
                         else
-                        {
-                            ms = 0;
                             break;
-                        }
                     }
                     else
                     {
-                        stream_decode(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen, ms, id, id + count, skip);
+                        stream_decode(&stream.dec, ms, id, id + count, skip);
                         break;
                     }
                 }
             }
+
+            // queue new frames and check threshold again, unless nothing was decoded
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            if (stream.frm_adds != adds)
+                stream.decoder_wake = true;
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
         }
     }
     CAZ(pthread_mutex_lock(&stream.decoder_mutex));
-    int frm_cnt = 0;
-    while (stream.frmlen > frm_cnt)
-        if (!stream_remove_frame(stream.frm[stream.frmlen - 1 - frm_cnt].ms, stream.frm[stream.frmlen - 1 - frm_cnt].id))
-            frm_cnt++;
+    CAZ(pthread_cond_signal(&stream.reverse_cond));
     CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+    CAZ(pthread_join(stream.reverse_tid, NULL));
 
-    if (stream.decoder_loader_ms)
-    {
-        CAZ(munmap(stream.decoder_loader_bd.b, stream.decoder_loader_bd.blen));
-        close(stream.decoder_loader_fd);
-        stream.decoder_loader_ms = 0;
-    }
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    stream_frame_flush();
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
 
+    stream_unmap(&stream.dec);
+
+    LOG("frame cache hits %lu misses %lu evicts %lu adds %lu\n", stream.frm_hits, stream.frm_misses, stream.frm_evicts, stream.frm_adds);
     LOG("DECODER THREAD END\n");
     return NULL;
 }
@@ -2655,10 +3891,23 @@ static void *stream_loader_thread(void *data)
 {
     LOG("LOADER THREAD START\n");
 
-    chunk_t ch[STREAM_MAX_FILES];
-    uint32_t chlen;
+    chunk_index_t fetch = {}, save = {}; // save: finished day snapshot written unlocked
+    uint64_t sync_ms = 0; // delta cursor (newest known chunk)
+    time_t sync_full = 0; // last full resync
+    bool finished = strcmp(stream.day, stream.actualday), cached = false;
 
-    assert(stream.chlen == 0);
+    // stream.chi may be seeded by prefetch, first full sync validates it
+    if (!stream.chi.len && finished && chunk_cache_load(&fetch, stream.day, stream.camid))
+    {
+        // start from cache, first full sync validates it
+        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        chunk_index_t chi = stream.chi;
+        stream.chi = fetch;
+        fetch = chi;
+        chunk_slots(&stream.chi);
+        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        cached = true;
+    }
 
     struct timespec prev_ts;
     clock_gettime(CLOCK_REALTIME, &prev_ts);
@@ -2667,89 +3916,353 @@ static void *stream_loader_thread(void *data)
     {
         struct timespec a_ts;
 
-        struct _u_request request;
-        struct _u_response response;
-        json_t *json;
-        char _cam[4];
-
-        CAP(snprintf(_cam, sizeof(_cam), "%u", stream.camid));
-
-        ulfius_init_request(&request);
-        ulfius_init_response(&response);
-        CAZ(ulfius_set_request_properties(&request,
-                                          U_OPT_HTTP_VERB, "GET",
-                                          U_OPT_HTTP_URL, stream.masteruri,
-                                          U_OPT_HTTP_URL_APPEND, "/chunks/",
-                                          U_OPT_HTTP_URL_APPEND, stream.day,
-                                          U_OPT_HTTP_URL_APPEND, "/",
-                                          U_OPT_HTTP_URL_APPEND, _cam,
-                                          U_OPT_TIMEOUT, 10ul,
-                                          U_OPT_NONE));
-        CAZ(ulfius_send_http_request(&request, &response));
-        int status = response.status;
-        CAVNZ(json, ulfius_get_json_body_response(&response, NULL));
-        ulfius_clean_response(&response);
-        ulfius_clean_request(&request);
+        bool full = !sync_ms || prev_ts.tv_sec - sync_full >= CHUNK_RESYNC;
 
-        chlen = 0;
+        int status = chunk_fetch(&fetch, stream.day, stream.camid, full ? 0 : sync_ms);
 
-        if (status / 100 == 2)
+        if (status / 100 != 2 && !full)
         {
-            A(json_is_array(json));
-            for (int i = 0; i < json_array_size(json); i++)
-            {
-                json_int_t srvid = json_integer_value(json_object_get(json_array_get(json, i), "srvid"));
-
-                json_t *tss = json_object_get(json_array_get(json, i), "ts");
-                A(json_is_array(tss));
-                size_t len = json_array_size(tss);
-                A(chlen + len < STREAM_MAX_FILES);
-                for (int j = 0; j < len; j++)
-                {
-                    CAV(ch[chlen].ms, strtoull(json_string_value(json_array_get(tss, j)), NULL, 16), != ULLONG_MAX);
-                    ch[chlen].srvid = srvid;
-                    chlen++;
-                }
-            }
-            json_decref(json);
+            // delta refused, resync
+            sync_full = 0;
+            continue;
         }
 
-        if (!chlen)
+        if (full && !fetch.len)
         {
+            // master down or day not listed yet, index from cache or watcher keeps playing
             LOG("LD: not ready %s\n", stream.day);
-            disp_plane_hide(stream.vi);
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            bool empty = !stream.chi.len;
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+            if (empty)
+                disp_plane_hide(stream.vi);
             usleep(LOOP_USLEEP);
             continue;
         }
-        qsort(ch, chlen, sizeof(ch[0]), compare_chunk);
+        uint32_t fetchlen = fetch.len;
 
         CAZ(pthread_mutex_lock(&stream.decoder_mutex));
-        if (memcmp(stream.ch, ch, sizeof(chunk_t) * stream.chlen))
-            stream.show_msec_seek = stream.show_msec;
-        memcpy(stream.ch, ch, sizeof(chunk_t) * chlen);
-        stream.chlen = chlen;
+        if (full)
+        {
+            // keep chunks found by watcher and not yet known to master
+            uint32_t tail = stream.chi.len;
+            sync_ms = fetch.ch[fetch.len - 1].ms;
+            while (tail && stream.chi.ch[tail - 1].ms > sync_ms)
+                tail--;
+            bool changed = chunk_carry(fetch.ch, fetch.len, stream.chi.ch, tail);
+            if (changed)
+                stream.show_msec_seek = stream.show_msec;
+            if (finished && (changed || !cached))
+            {
+                chunk_reserve(&save, fetch.len);
+                memcpy(save.ch, fetch.ch, sizeof(chunk_t) * fetch.len);
+                save.len = fetch.len;
+                cached = true;
+            }
+            chunk_reserve(&fetch, fetch.len + stream.chi.len - tail);
+            memcpy(fetch.ch + fetch.len, stream.chi.ch + tail, sizeof(chunk_t) * (stream.chi.len - tail));
+            fetch.len += stream.chi.len - tail;
+
+            // swap, old index is next scratch
+            chunk_index_t chi = stream.chi;
+            stream.chi = fetch;
+            fetch = chi;
+            chunk_slots(&stream.chi);
+            sync_full = prev_ts.tv_sec;
+            if (changed)
+                stream_decoder_wake();
+            if (save.len)
+            {
+                // file I/O without decoder_mutex
+                CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+                chunk_cache_save(&save, stream.day, stream.camid);
+                save.len = 0;
+                CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            }
+        }
+        else if (fetch.len)
+        {
+            bool mismatch = false;
+            uint64_t last_ms = fetch.ch[fetch.len - 1].ms;
+            chunk_merge(&stream.chi, fetch.ch, fetch.len, sync_ms, &mismatch);
+            if (mismatch)
+            {
+                LOG("L: delta mismatch, resync\n");
+                sync_full = 0;
+            }
+            if (last_ms > sync_ms)
+                sync_ms = last_ms;
+            stream_decoder_wake(); // new chunks at the end of index
+        }
 
-        LOG("L: refresh %ld.%ld chunks %d\n", prev_ts.tv_sec, prev_ts.tv_sec / NS_IN_MSEC, chlen);
+        LOG("L: refresh %ld.%ld chunks %d (%s %d)\n", prev_ts.tv_sec, prev_ts.tv_sec / NS_IN_MSEC, stream.chi.len, full ? "full" : "delta", fetchlen);
 
-        while (!stream.stopping && !stream.switching && !clock_gettime(CLOCK_REALTIME, &a_ts) && a_ts.tv_sec == prev_ts.tv_sec && !pthread_cond_wait(&stream.decoder_cond, &stream.decoder_mutex))
-            ;
+        // next second, own condition, decoder wakeups do not spin loader
+        struct timespec next_ts = {prev_ts.tv_sec + 1, 0};
+        int ret = 0;
+        while (!stream.stopping && !stream.switching && ret != ETIMEDOUT)
+            CAV(ret, pthread_cond_timedwait(&stream.loader_cond, &stream.decoder_mutex, &next_ts), == 0 || ret == ETIMEDOUT);
+        clock_gettime(CLOCK_REALTIME, &a_ts);
         prev_ts = a_ts;
         CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
     }
 
+    chunk_free(&fetch);
+    chunk_free(&save);
     LOG("LOADER THREAD END\n");
     return NULL;
 }
 
+// +++ WATCHER
+
+static void *stream_watcher_thread(void *data)
+{
+    int fd, wd[UINT8_MAX + 1];
+    time_t scan = 0;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    chunk_t ch[CHUNK_WATCH_EVENTS(sizeof(buf))];
+
+    LOG("WATCHER THREAD START\n");
+
+    for (int i = 0; i <= UINT8_MAX; i++)
+        wd[i] = -1;
+    CAVZP(fd, inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+
+    while (!stream.stopping && !stream.switching)
+    {
+        struct timespec a_ts;
+        clock_gettime(CLOCK_MONOTONIC, &a_ts);
+        if (a_ts.tv_sec != scan)
+        {
+            scan = a_ts.tv_sec;
+            chunk_watch_scan(fd, wd, stream.path, stream.day, stream.camid);
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, WATCH_POLL_MSEC) <= 0)
+            continue;
+
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0)
+        {
+            uint32_t chlen = chunk_watch_read(wd, buf, len, ch);
+            if (!chlen)
+                continue;
+
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            if (stream.chi.len) // after first master sync
+            {
+                chunk_merge(&stream.chi, ch, chlen, 0, NULL);
+                stream_decoder_wake();
+            }
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        }
+    }
+
+    close(fd);
+    LOG("WATCHER THREAD END\n");
+    return NULL;
+}
+
+// +++ PREFETCH
+
+static void *stream_prefetch_thread(void *data)
+{
+    chunk_index_t fetch = {};
+    uint32_t mat = 0;
+    time_t prev = 0;
+    uint64_t sync_ms[MAX_CAM] = {}; // delta cursor per slot (newest known chunk)
+    time_t sync_full[MAX_CAM] = {}; // last full resync per slot
+
+    LOG("PREFETCH THREAD START\n");
+
+    while (!stream.stopping)
+    {
+        config_t *cams[MAX_CAM];
+        uint32_t camids[MAX_CAM] = {};
+        char day[sizeof(stream.day)];
+        time_t now = time(NULL);
+        uint32_t active;
+
+        // snapshot actual mat
+        CAZ(pthread_mutex_lock(&stream.cmd_mutex));
+        config_t *config = get_config(stream.camid_switch);
+        bool changed = config && config->mat != mat;
+        if (config)
+        {
+            mat = config->mat;
+            get_config_cam(mat, cams);
+            for (int i = 0; i < MAX_CAM; i++)
+                if (cams[i])
+                    camids[i] = cams[i]->camid;
+        }
+        strcpy(day, stream.day);
+        active = stream.camid;
+        CAZ(pthread_mutex_unlock(&stream.cmd_mutex));
+
+        if (!config || !*day || (!changed && now - prev < CHUNK_PREFETCH))
+        {
+            usleep(LOOP_USLEEP);
+            continue;
+        }
+        prev = now;
+
+        for (int i = 0; i < MAX_CAM && !stream.stopping; i++)
+        {
+            if (camids[i] && camids[i] == active)
+                continue; // loader keeps it, slot refreshed after switch away
+
+            // only this thread writes slots, read without lock
+            bool known = camids[i] && stream.prefetch[i].camid == camids[i] && !strcmp(stream.prefetch[i].day, day) && stream.prefetch[i].ci.len;
+            bool full = !known || now - sync_full[i] >= CHUNK_RESYNC;
+
+            if (camids[i] && (chunk_fetch(&fetch, day, camids[i], full ? 0 : sync_ms[i]) / 100 != 2 || (full && !fetch.len)))
+            {
+                sync_full[i] = 0; // keep previous, delta refused resyncs
+                continue;
+            }
+            if (!full)
+            {
+                if (!fetch.len)
+                    continue;
+                bool mismatch = false;
+                uint64_t last_ms = fetch.ch[fetch.len - 1].ms;
+                CAZ(pthread_mutex_lock(&stream.prefetch_mutex));
+                chunk_merge(&stream.prefetch[i].ci, fetch.ch, fetch.len, sync_ms[i], &mismatch);
+                CAZ(pthread_mutex_unlock(&stream.prefetch_mutex));
+                if (mismatch)
+                    sync_full[i] = 0;
+                if (last_ms > sync_ms[i])
+                    sync_ms[i] = last_ms;
+                continue;
+            }
+            sync_ms[i] = fetch.len ? fetch.ch[fetch.len - 1].ms : 0;
+            sync_full[i] = now;
+            chunk_slots(&fetch); // delta merges look up in it
+
+            // swap, old list is next scratch
+            CAZ(pthread_mutex_lock(&stream.prefetch_mutex));
+            chunk_index_t ci = stream.prefetch[i].ci;
+            stream.prefetch[i].ci = fetch;
+            stream.prefetch[i].camid = camids[i];
+            strcpy(stream.prefetch[i].day, day);
+            CAZ(pthread_mutex_unlock(&stream.prefetch_mutex));
+            fetch = ci;
+            fetch.len = 0;
+        }
+        DBG("P: mat %d refreshed\n", mat);
+    }
+
+    chunk_free(&fetch);
+    LOG("PREFETCH THREAD END\n");
+    return NULL;
+}
+
 // +++ SHOW
 
+static void stream_frame_flipped(uint32_t prime_fd, uint32_t sequence, uint64_t ns, void *data)
+{
+    // video plane flip done, released prime_fd is off screen
+    DBG("S: flip %u released %u\n", sequence, prime_fd);
+    stream.show_flip_ns = ns;
+    __atomic_store_n(&stream.show_flip_seq, sequence, __ATOMIC_RELEASE);
+}
+
+static uint64_t stream_pace_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_IN_SEC + ts.tv_nsec;
+}
+
+static void stream_pace_add(pace_t *p, uint32_t target)
+{
+    // close record of previous frame by its flip event, single writer (show thread)
+    uint32_t flip_seq = __atomic_load_n(&stream.show_flip_seq, __ATOMIC_ACQUIRE);
+    if ((int32_t)(flip_seq - target) >= 0)
+    {
+        p->flip_ns = stream.show_flip_ns;
+        p->late = flip_seq - target;
+    }
+    else
+        p->late = -1; // not flipped yet
+
+    uint32_t head = stream.pace_head;
+    stream.pace[head % PACE_RING] = *p;
+    __atomic_store_n(&stream.pace_head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&stream.pace_frames, 1, __ATOMIC_RELAXED);
+    if (p->late >= 0)
+    {
+        uint64_t jitter = (p->flip_ns > p->due_ns ? p->flip_ns - p->due_ns : p->due_ns - p->flip_ns) / NS_IN_MSEC;
+        __atomic_fetch_add(&stream.pace_jitter[FFMIN(jitter, PACE_BUCKETS - 1)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stream.pace_late[FFMIN(p->late, PACE_BUCKETS - 1)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stream.pace_repeats, p->late, __ATOMIC_RELAXED); // previous frame held over
+    }
+}
+
+void stream_pace_dump(void)
+{
+    // histograms since start, commit and jitter summary of last PACE_RING frames, frame cache counters
+    static pace_t ring[PACE_RING];
+    uint32_t head = __atomic_load_n(&stream.pace_head, __ATOMIC_ACQUIRE);
+    uint32_t from = head > PACE_RING ? head - PACE_RING : 0;
+    for (uint32_t i = from; i < head; i++)
+        ring[i % PACE_RING] = stream.pace[i % PACE_RING];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t now = __atomic_load_n(&stream.pace_head, __ATOMIC_RELAXED);
+    if (now >= PACE_RING && from <= now - PACE_RING)
+        from = now - PACE_RING + 1; // overwritten while copied
+
+    uint64_t commit_sum = 0, commit_max = 0, jitter_sum = 0, jitter_max = 0, n = 0;
+    for (uint32_t i = from; i < head; i++)
+    {
+        pace_t *p = &ring[i % PACE_RING];
+        uint64_t commit = p->done_ns - p->start_ns;
+        commit_sum += commit;
+        commit_max = FFMAX(commit_max, commit);
+        if (p->flip_ns)
+        {
+            uint64_t jitter = p->flip_ns > p->due_ns ? p->flip_ns - p->due_ns : p->due_ns - p->flip_ns;
+            jitter_sum += jitter;
+            jitter_max = FFMAX(jitter_max, jitter);
+            n++;
+        }
+    }
+
+    LOG("pace frames %lu repeats %lu drops %lu misses %lu syncs %lu\n",
+        __atomic_load_n(&stream.pace_frames, __ATOMIC_RELAXED), __atomic_load_n(&stream.pace_repeats, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream.pace_drops, __ATOMIC_RELAXED), __atomic_load_n(&stream.pace_misses, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream.pace_syncs, __ATOMIC_RELAXED));
+    char jitter[PACE_BUCKETS * 21 + 1], late[PACE_BUCKETS * 21 + 1];
+    int jl = 0, ll = 0;
+    for (int i = 0; i < PACE_BUCKETS; i++)
+    {
+        jl += snprintf(jitter + jl, sizeof(jitter) - jl, " %lu", __atomic_load_n(&stream.pace_jitter[i], __ATOMIC_RELAXED));
+        ll += snprintf(late + ll, sizeof(late) - ll, " %lu", __atomic_load_n(&stream.pace_late[i], __ATOMIC_RELAXED));
+    }
+    LOG("pace jitter ms:%s\n", jitter);
+    LOG("pace late vblanks:%s\n", late);
+    if (head > from)
+        LOG("pace last %u commit avg %lu max %lu us, jitter avg %lu max %lu us\n", head - from,
+            commit_sum / (head - from) / 1000, commit_max / 1000, n ? jitter_sum / n / 1000 : 0, jitter_max / 1000);
+
+    // decoder_mutex not taken (signal path), counters only grow
+    LOG("frame cache hits %lu misses %lu evicts %lu adds %lu frames %u/%u\n",
+        __atomic_load_n(&stream.frm_hits, __ATOMIC_RELAXED), __atomic_load_n(&stream.frm_misses, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream.frm_evicts, __ATOMIC_RELAXED), __atomic_load_n(&stream.frm_adds, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream.frmlen, __ATOMIC_RELAXED), stream.frm_max);
+    uint64_t opens = __atomic_load_n(&stream.open_count, __ATOMIC_RELAXED), gops = __atomic_load_n(&stream.gop_count, __ATOMIC_RELAXED);
+    LOG("chunk open %lu avg %lu us, keyframe index %lu avg %lu us\n",
+        opens, opens ? __atomic_load_n(&stream.open_ns, __ATOMIC_RELAXED) / opens / 1000 : 0,
+        gops, gops ? __atomic_load_n(&stream.gop_ns, __ATOMIC_RELAXED) / gops / 1000 : 0);
+}
+
 void *stream_show_thread(void *param)
 {
     LOG("SHOW THREAD START\n");
 
-    assert(stream.show_id == 0 && stream.show_ms == 0);
-
-    while (!stream.chlen && !stream.stopping && !stream.switching)
+    while (!stream.chi.len && !stream.stopping && !stream.switching)
         usleep(5000);
 
     struct timespec prev_ts;
@@ -2762,158 +4275,124 @@ void *stream_show_thread(void *param)
             stream.show_msec_seek = prev_ts.tv_sec * 1000 + prev_ts.tv_nsec / NS_IN_MSEC - 5000; // start from t-5sec
     }
 
+    // presentation clock is display vblank, frame duration rounded to refresh periods (2:3 cadence on 60 Hz)
+    // frame duration is its PTS distance from the previous shown frame, scaled by the speed wait
+    uint64_t vblank_ns = disp_vblank_ns(), vblank_due = 0, prev_msec = 0;
+    uint32_t vblank_base = 0, flip_target = 0, pace_flags = 0;
+    pace_t pace;
+
+    uint32_t rd = stream.showq_rd, woke = rd - 1;
+    CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+    stream_decoder_wake(); // initial seek
+    CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+
     while (!stream.stopping && !stream.switching)
     {
         AVFrame *frame = NULL;
-        uint64_t frame_wait;
-
-        CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+        uint64_t frame_wait, frame_msec = 0;
 
-    reload:
-        if (stream.show_msec_seek)
+        // pop without lock, skip frames queued before seek or speed change
+        uint32_t head = __atomic_load_n(&stream.showq_head, __ATOMIC_ACQUIRE);
+        uint32_t gen = __atomic_load_n(&stream.showq_gen, __ATOMIC_ACQUIRE);
+        showq_t *q = NULL;
+        while (rd != head && !q)
         {
-            stream.show_msec = stream.show_msec_seek;
-            stream.show_msec_seek = 0;
-
-            chunk_t *lms = stream.ch, *rms = stream.ch + stream.chlen - 1;
-            // find nearest low
-            while (lms < rms)
-            {
-                DBG("S:1 %ld %ld %u | %lu %lu %lu\n", lms - stream.ch, rms - stream.ch, stream.chlen, lms->ms, stream.show_msec, rms->ms);
-                chunk_t *mms = lms + ((rms - lms) / 2);
-                if (stream.show_msec < mms->ms)
-                    rms = mms - 1;
-                else
-                    lms = mms + 1;
-            }
-            if (stream.show_msec < lms->ms && lms - stream.ch > 0)
-                lms--;
-            DBG("S:2 %ld %ld %u | %lu %lu %lu\n", lms - stream.ch, rms - stream.ch, stream.chlen, lms->ms, stream.show_msec, rms->ms);
+            showq_t *e = &stream.showq[rd++ % SHOW_QUEUE];
+            if (e->gen == gen && e->speed == stream.speed)
+                q = e;
+        }
+        __atomic_store_n(&stream.showq_rd, rd, __ATOMIC_RELEASE);
 
-            stream.show_ms = lms->ms;
-            if (stream.show_msec < lms->ms || (stream.show_msec - lms->ms) > STREAM_FRAMES * STREAM_FPS_MSEC)
-                stream.show_id = 0;
-            else
-                stream.show_id = ((stream.show_msec - lms->ms) / STREAM_FPS_MSEC) / stream.show_skip * stream.show_skip;
-            DBG("S:3 start search %lu/%d == %ld == %ld ~ %ld\n", stream.show_ms, stream.show_id, stream.show_ms + stream.show_id * STREAM_FPS_MSEC, stream.show_msec, stream.show_ms + stream.show_id * STREAM_FPS_MSEC - stream.show_msec);
+        // wake decoder only at refill point or on seek
+        uint32_t wake = __atomic_load_n(&stream.showq_wake, __ATOMIC_ACQUIRE);
+        if (stream.show_msec_seek || ((int32_t)(rd - wake) >= 0 && wake != woke))
+        {
+            woke = wake;
+            CAZ(pthread_mutex_lock(&stream.decoder_mutex));
+            stream_decoder_wake();
+            CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
         }
 
-        for (int i = 0; i < stream.frmlen; i++)
-            if (stream.show_ms == stream.frm[i].ms && stream.show_id == stream.frm[i].id)
+        if (q)
+        {
+            // frame to show ready
+            frame = q->frame;
+            frame_msec = q->msec;
+            frame_wait = stream.show_wait;
+            if (prev_msec)
             {
-                stream.show_p_id = stream.show_a_id;
-                stream.show_p_ms = stream.show_a_ms;
-                stream.show_a_id = stream.show_id;
-                stream.show_a_ms = stream.show_ms;
-
-                // frame to show ready
-                frame = stream.frm[i].frame;
-                frame_wait = stream.show_wait;
-
-                // compute next frame
-                chunk_t _show_ms = {stream.show_ms, 0};
-                chunk_t *pms = bsearch(&_show_ms, stream.ch, stream.chlen, sizeof(stream.ch[0]), compare_chunk);
-                if (!pms)
-                {
-                    stream.show_msec_seek = stream.show_msec;
-                    goto reload;
-                }
-
-                if (stream.speed > 0)
-                {
-                    if (stream.show_id + stream.show_skip >= STREAM_FRAMES)
-                    {
-                        if ((pms + 1 - stream.ch) < stream.chlen)
-                        {
-                            stream.show_id = 0;
-                            stream.show_ms = (pms + 1)->ms;
-                        } // else stop (end reached) and wait for new chunk
-                    }
-                    else
-                        stream.show_id += stream.show_skip;
-                }
-                else if (stream.speed < 0)
-                {
-                    if (stream.show_id < stream.show_skip)
-                    {
-                        if ((pms - 1 - stream.ch) >= 0)
-                        {
-                            stream.show_id = (stream.show_id + STREAM_FRAMES - stream.show_skip) / stream.show_skip * stream.show_skip;
-                            stream.show_ms = (pms - 1)->ms;
-                        } // else stop (begin reached)
-                    }
-                    else
-                        stream.show_id -= stream.show_skip;
-                } // ignore SPEED_PAUSE
-                break;
+                uint64_t delta = frame_msec > prev_msec ? frame_msec - prev_msec : prev_msec - frame_msec;
+                if (delta && delta <= 2 * stream.show_skip * STREAM_FPS_MSEC)
+                    frame_wait = delta * NS_IN_MSEC * stream.show_wait / (STREAM_FPS_NSEC * stream.show_skip);
             }
-        CAZ(pthread_cond_broadcast(&stream.decoder_cond));
-        CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
+        }
 
         if (frame)
         {
-            DBG("S: frame start %ld/%d\n", stream.show_a_ms, stream.show_a_id);
+            DBG("S: frame start %ld/%d\n", q->ms, q->id);
             // wait for showtime
             CAZ(pthread_mutex_lock(&stream.info_mutex));
-            uint64_t ns = (stream.show_ms % 1000) * 1000000 + 1000000l * stream.show_id * STREAM_FPS_MSEC;
-            stream.info_time.tv_nsec = ns % 1000000000;
-            stream.info_time.tv_sec = (stream.show_ms / 1000) + ns / 1000000000;
-            normalize_ts(&stream.info_time);
+            stream.info_time.tv_nsec = (frame_msec % 1000) * NS_IN_MSEC;
+            stream.info_time.tv_sec = frame_msec / 1000;
             CAZ(pthread_mutex_unlock(&stream.info_mutex));
 
-            struct timespec a_ts, sleep_ts;
-            clock_gettime(CLOCK_REALTIME, &a_ts);
-
-            frame_wait -= STREAM_FPS_NSEC;
-            prev_ts.tv_nsec += STREAM_FPS_NSEC;
-            normalize_ts(&prev_ts);
-            sleep_ts.tv_sec = prev_ts.tv_sec - a_ts.tv_sec;
-            sleep_ts.tv_nsec = prev_ts.tv_nsec - a_ts.tv_nsec;
-            normalize_ts(&sleep_ts);
-            DBG("S: sleep p:%ld.%03ld a:%ld.%03ld s:%ld.%03ld\n", prev_ts.tv_sec, prev_ts.tv_nsec / 1000000, a_ts.tv_sec, a_ts.tv_nsec / 1000000, sleep_ts.tv_sec, sleep_ts.tv_nsec / 1000000);
-            if (sleep_ts.tv_sec >= 0 && sleep_ts.tv_nsec > 0)
+            if (!vblank_base)
             {
-                while (nanosleep(&sleep_ts, &a_ts) < 0)
-                {
-                    assert(errno == EINTR);
-                    sleep_ts = a_ts;
-                }
+                vblank_base = disp_wait(0, NULL) + 1;
+                vblank_due = 0;
             }
-
-            DBG("S: frame show %lu/%d\n", stream.show_a_ms, stream.show_a_id);
-            stream.show_msec = stream.show_a_ms + stream.show_a_id * STREAM_FPS_MSEC;
-            stream_show_frame(frame);
-
-            if (frame_wait > 0)
+            else
+                vblank_due += frame_wait; // previous frame held for its duration
+            prev_msec = frame_msec;
+            uint32_t target = vblank_base + (vblank_due + vblank_ns / 2) / vblank_ns;
+            uint64_t seq_ns;
+            uint32_t seq = disp_wait(target - 1, &seq_ns); // commit latches on target
+            if (flip_target)
             {
-                clock_gettime(CLOCK_REALTIME, &a_ts);
-
-                prev_ts.tv_nsec += frame_wait;
-                normalize_ts(&prev_ts);
-                sleep_ts.tv_sec = prev_ts.tv_sec - a_ts.tv_sec;
-                sleep_ts.tv_nsec = prev_ts.tv_nsec - a_ts.tv_nsec;
-                normalize_ts(&sleep_ts);
-
-                DBG("S: sleep loger p:%ld.%03ld a:%ld.%03ld s:%ld.%03ld\n", prev_ts.tv_sec, prev_ts.tv_nsec / 1000000, a_ts.tv_sec, a_ts.tv_nsec / 1000000, sleep_ts.tv_sec, sleep_ts.tv_nsec / 1000000);
-                if (sleep_ts.tv_sec >= 0 && sleep_ts.tv_nsec > 0)
+                stream_pace_add(&pace, flip_target);
+                if (pace.late > 0)
+                    LOG("S: flip %d vblanks late\n", pace.late);
+                if ((int32_t)(target - flip_target) <= 0)
                 {
-                    while (nanosleep(&sleep_ts, &a_ts) < 0)
-                    {
-                        assert(errno == EINTR);
-                        sleep_ts = a_ts;
-                    }
+                    pace_flags |= PACE_DROP;
+                    __atomic_fetch_add(&stream.pace_drops, 1, __ATOMIC_RELAXED);
                 }
             }
-
-            if (sleep_ts.tv_sec < 0 || sleep_ts.tv_nsec < -2 * NS_IN_MSEC)
+            if ((int32_t)(seq - (target - 1)) > 0)
             {
-                prev_ts = a_ts;
-                LOG("S: sync %ld.%03ld\n", sleep_ts.tv_sec, sleep_ts.tv_nsec / NS_IN_MSEC);
+                // missed, restart cadence from now
+                LOG("S: sync %d vblanks late\n", seq - (target - 1));
+                vblank_base = target = seq + 1;
+                vblank_due = 0;
+                pace_flags |= PACE_SYNC;
+                __atomic_fetch_add(&stream.pace_syncs, 1, __ATOMIC_RELAXED);
             }
+
+            DBG("S: frame show %lu/%d vblank %u\n", q->ms, q->id, target);
+            pace = (pace_t){.due_ns = seq_ns + (target - seq) * vblank_ns, .flags = pace_flags};
+            pace_flags = 0;
+            stream.show_msec = frame_msec;
+            pace.start_ns = stream_pace_ns();
+            stream_show_frame(frame);
+            pace.done_ns = stream_pace_ns();
+            flip_target = target;
+
+            // commit waited for previous flip, older entries are off screen
+            __atomic_store_n(&stream.showq_tail, stream.showq_shown, __ATOMIC_RELEASE);
+            stream.showq_shown = rd - 1;
         }
         else
         {
             DBG("S: wait 10ms\n");
+            if (flip_target)
+                stream_pace_add(&pace, flip_target);
+            if (flip_target && stream.speed)
+            {
+                // stalled on cache miss
+                pace_flags |= PACE_MISS;
+                __atomic_fetch_add(&stream.pace_misses, 1, __ATOMIC_RELAXED);
+            }
+            vblank_base = flip_target = 0; // restart cadence with next frame
             struct timespec a_ts, sleep_ts;
             sleep_ts.tv_sec = 0;
             sleep_ts.tv_nsec = 10 * NS_IN_MSEC;
@@ -2928,6 +4407,7 @@ void *stream_show_thread(void *param)
 
     CAZ(pthread_mutex_lock(&stream.decoder_mutex));
     CAZ(pthread_cond_broadcast(&stream.decoder_cond));
+    CAZ(pthread_cond_broadcast(&stream.loader_cond));
     CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
 
     LOG("SHOW THREAD END\n");
@@ -2959,6 +4439,7 @@ void *stream_cmd_thread(void *param)
             stream.show_wait = speed_params[abs(stream.speed)].wait;
             speed_bigskip = 4;
             LOG("C: change speed %d/%ld (new %d)\n", stream.show_skip, stream.show_wait / NS_IN_MSEC, stream.show_id);
+            stream_decoder_wake(); // requeue at new speed
             CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
             speed_prev = stream.speed;
         }
@@ -2976,23 +4457,23 @@ void *stream_cmd_thread(void *param)
             {
                 speed_bigskip++;
                 wt = stream.show_wait = STREAM_FPS_NSEC * 2;
-                chunk_t _show_ms = {stream.show_ms, 0};
-                chunk_t *pms = bsearch(&_show_ms, stream.ch, stream.chlen, sizeof(stream.ch[0]), compare_chunk);
+                chunk_t *pms = chunk_get(&stream.chi, stream.show_ms);
                 if (pms)
                 {
+                    int64_t idx = pms - stream.chi.ch;
                     if (stream.speed == -SPEED_SKIP)
                     {
-                        pms -= speed_bigskip / 2;
-                        if (pms < stream.ch)
-                            pms = stream.ch;
+                        idx -= speed_bigskip / 2;
+                        if (idx < 0)
+                            idx = 0;
                     }
                     else
                     {
-                        pms += speed_bigskip / 2;
-                        if (pms > stream.ch + stream.chlen)
-                            pms = stream.ch + stream.chlen - 1;
+                        idx += speed_bigskip / 2;
+                        if (idx >= stream.chi.len)
+                            idx = stream.chi.len - 1;
                     }
-                    stream.show_msec_seek = pms->ms;
+                    stream.show_msec_seek = stream.chi.ch[idx].ms;
                 }
             }
             CAZ(pthread_mutex_unlock(&stream.decoder_mutex));
@@ -3012,6 +4493,8 @@ void *stream_cmd_thread(void *param)
                 CAZ(pthread_mutex_unlock(&stream.info_mutex));
                 CAZ(pthread_join(stream.decoder_tid, NULL));
                 CAZ(pthread_join(stream.loader_tid, NULL));
+                if (STREAM_WATCH)
+                    CAZ(pthread_join(stream.watcher_tid, NULL));
 
                 CAZ(pthread_mutex_lock(&stream.cmd_mutex));
             }
@@ -3033,8 +4516,12 @@ void *stream_cmd_thread(void *param)
                 }
 
                 stream.switching = false;
-                stream.show_id = stream.show_ms = stream.chlen = 0;
+                stream.show_id = stream.show_ms = stream.chi.len = 0;
+                if (STREAM_PREFETCH && chunk_prefetch_get(&stream.chi, stream.day, stream.camid))
+                    LOG("C: prefetched chunks %d\n", stream.chi.len);
                 CAZ(pthread_create(&stream.loader_tid, NULL, stream_loader_thread, NULL));
+                if (STREAM_WATCH)
+                    CAZ(pthread_create(&stream.watcher_tid, NULL, stream_watcher_thread, NULL));
                 CAZ(pthread_create(&stream.decoder_tid, NULL, stream_decoder_thread, NULL));
                 CAZ(pthread_create(&stream.show_tid, NULL, stream_show_thread, NULL));
             }
@@ -3062,6 +4549,8 @@ void *stream_cmd_thread(void *param)
         CAZ(pthread_join(stream.show_tid, NULL));
         CAZ(pthread_join(stream.decoder_tid, NULL));
         CAZ(pthread_join(stream.loader_tid, NULL));
+        if (STREAM_WATCH)
+            CAZ(pthread_join(stream.watcher_tid, NULL));
     }
 
     LOG("COMMANDER THREAD END\n");
@@ -3070,9 +4559,16 @@ void *stream_cmd_thread(void *param)
 
 void sig_handler(int signum)
 {
-    LOG("SIGNAL %d\n", signum);
-    stream.stopping++;
-    exit(1);
+    // only flags here, main loop logs and dumps outside signal context
+    if (signum == SIGUSR1)
+    {
+        stream.pace_dump = 1;
+        return;
+    }
+    if (stream.signaled)
+        _exit(1); // main loop did not get to it, e.g. stuck itself
+    stream.signaled = signum;
+    stream.pace_dump = 1;
 }
 
 int main(int argc, char **argv)
@@ -3097,6 +4593,7 @@ int main(int argc, char **argv)
     signal(SIGINT, sig_handler);
     signal(SIGPIPE, sig_handler);
     signal(SIGALRM, sig_handler);
+    signal(SIGUSR1, sig_handler);
 
     // initial params
     strncpy(stream.path, argv[1], sizeof(stream.path) - 1);
@@ -3127,10 +4624,15 @@ int main(int argc, char **argv)
     CAZ(pthread_mutex_init(&stream.info_mutex, NULL));
     CAZ(pthread_mutex_init(&stream.decoder_mutex, NULL));
     CAZ(pthread_cond_init(&stream.decoder_cond, NULL));
+    CAZ(pthread_cond_init(&stream.loader_cond, NULL));
+    CAZ(pthread_cond_init(&stream.reverse_cond, NULL));
     CAZ(pthread_mutex_init(&stream.scale_mutex, NULL));
+    CAZ(pthread_mutex_init(&stream.prefetch_mutex, NULL));
     CAZ(pthread_cond_init(&stream.scale_cond, NULL));
 
     disp_setup(NULL, &stream.vi, &stream.ui, &stream.crtc_width, &stream.crtc_height);
+    disp_plane_release(stream.vi, stream_frame_flipped, NULL);
+    stream_frame_budget(stream.crtc_width * stream.crtc_height * 3 / 2); // until first decoded frame
     hid_setup(NULL);
     if (INFO_DRAW_FINGER)
         for (int i = 0; i < MT_FINGERS; i++)
@@ -3140,6 +4642,8 @@ int main(int argc, char **argv)
     CAZ(pthread_create(&stream.info_tid, NULL, stream_info_thread, NULL));
     CAZ(pthread_create(&stream.cmd_tid, NULL, stream_cmd_thread, NULL));
     CAZ(pthread_create(&stream.scale_tid, NULL, stream_scale_thread, NULL));
+    if (STREAM_PREFETCH)
+        CAZ(pthread_create(&stream.prefetch_tid, NULL, stream_prefetch_thread, NULL));
 
     srand((unsigned int)time(NULL));
 
@@ -3197,6 +4701,18 @@ int main(int argc, char **argv)
             }
         }
 
+        if (stream.pace_dump)
+        {
+            stream.pace_dump = 0;
+            stream_pace_dump();
+        }
+        if (stream.signaled)
+        {
+            LOG("SIGNAL %d\n", stream.signaled);
+            stream.stopping++;
+            exit(1);
+        }
+
         stream.info_touch = hid_ping();
         if (!stream.info_touch)
         {
@@ -3219,9 +4735,13 @@ int main(int argc, char **argv)
     CAZ(pthread_join(stream.scale_tid, NULL));
     CAZ(pthread_join(stream.cmd_tid, NULL));
     CAZ(pthread_join(stream.info_tid, NULL));
+    if (STREAM_PREFETCH)
+        CAZ(pthread_join(stream.prefetch_tid, NULL));
 
+    stream_pace_dump();
     stream_cleanup();
     hid_cleanup();
     info_cleanup();
     disp_cleanup();
+    return 0;
 }
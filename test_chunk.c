@@ -0,0 +1,188 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+// local chunk discovery against temporary recording tree: make test
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "globals.h"
+#include "chunk.h"
+#include "chunk_watch.h"
+
+#define TEST_DAY "2023-11-02"
+#define TEST_CAM 3
+#define TEST_MS0 0x18b8fa11000ul
+
+static char root[64];
+static int fd, wd[UINT8_MAX + 1];
+static chunk_index_t ci;
+
+static void test_dir(int srvid)
+{
+    char fn[256];
+
+    snprintf(fn, sizeof(fn), "%s/" SRVF, root, srvid);
+    CAZ(mkdir(fn, 0755));
+    snprintf(fn, sizeof(fn), "%s/" SRVF "/%s", root, srvid, TEST_DAY);
+    CAZ(mkdir(fn, 0755));
+    snprintf(fn, sizeof(fn), "%s/" SRVF "/%s/" CAMF, root, srvid, TEST_DAY, TEST_CAM);
+    CAZ(mkdir(fn, 0755));
+}
+
+static void test_file(int srvid, const char *name, bool move)
+{
+    // recorder writes in place (close after write) or renames finished file
+    char fn[256], tmp[256 + 4];
+    int f;
+
+    snprintf(fn, sizeof(fn), "%s/" SRVF "/%s/" CAMF "/%s", root, srvid, TEST_DAY, TEST_CAM, name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+    CAVZP(f, open(move ? tmp : fn, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    CA(write(f, "\x47", 1), == 1);
+    CAZ(close(f));
+    if (move)
+        CAZ(rename(tmp, fn));
+}
+
+static uint32_t test_events(uint32_t expect)
+{
+    // read until expected chunks arrived (or timeout), merge as watcher does
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    chunk_t ch[CHUNK_WATCH_EVENTS(sizeof(buf))];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    uint32_t n = 0;
+    ssize_t len;
+
+    while (poll(&pfd, 1, n < expect ? 1000 : 50) > 0)
+        while ((len = read(fd, buf, sizeof(buf))) > 0)
+        {
+            uint32_t chlen = chunk_watch_read(wd, buf, len, ch);
+            for (uint32_t i = 1; i < chlen; i++)
+                A(ch[i - 1].ms <= ch[i].ms);
+            n += chlen;
+            chunk_merge(&ci, ch, chlen, 0, NULL);
+        }
+    return n;
+}
+
+static void test_chunk(uint32_t i, uint64_t ms, int srvid)
+{
+    A(i < ci.len);
+    A(ci.ch[i].ms == ms && ci.ch[i].srvid == srvid && !ci.ch[i].frames);
+    A(chunk_get(&ci, ms) == ci.ch + i);
+}
+
+static void test_parse_carry(void)
+{
+    // listing parsed into reused scratch, learned frames kept for same chunk of same server
+    const char *b = "[{\"srvid\":1,\"ts\":[\"10\",\"20\"]},{\"srvid\":2,\"ts\":[\"30\"]}]";
+    chunk_index_t fetch = {};
+    chunk_t old[3] = {{0x10, 1, 77}, {0x20, 2, 88}, {0x30, 2, 99}};
+
+    chunk_reserve(&fetch, 3);
+    memset(fetch.ch, 0xff, 3 * sizeof(chunk_t));
+    CA(chunk_parse(&fetch, b, strlen(b)), == true);
+    A(fetch.len == 3);
+    for (uint32_t i = 0; i < fetch.len; i++)
+        A(!fetch.ch[i].frames);
+
+    A(chunk_carry(fetch.ch, fetch.len, old, 3));
+    A(fetch.ch[0].frames == 77 && !fetch.ch[1].frames && fetch.ch[2].frames == 99);
+    old[1].srvid = 1;
+    A(!chunk_carry(fetch.ch, fetch.len, old, 3));
+    A(fetch.ch[1].frames == 88);
+    A(chunk_carry(fetch.ch, fetch.len, old, 2));
+    chunk_free(&fetch);
+}
+
+int main(int argc, char **argv)
+{
+    char name[256], *dir;
+
+    test_parse_carry();
+
+    strcpy(root, "/tmp/test_chunk-XXXXXX");
+    CAVNZ(dir, mkdtemp(root));
+    for (int i = 0; i <= UINT8_MAX; i++)
+        wd[i] = -1;
+    CAVZP(fd, inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+
+    // master list known before watcher merges
+    chunk_t seed[2] = {{TEST_MS0, 0}, {TEST_MS0 + 4000, 0}};
+    chunk_merge(&ci, seed, 2, 0, NULL);
+
+    // only servers with the camera directory are watched, others on rescan
+    test_dir(0);
+    test_dir(7);
+    snprintf(name, sizeof(name), "%s/" SRVF, root, 2);
+    CAZ(mkdir(name, 0755));
+    chunk_watch_scan(fd, wd, root, TEST_DAY, TEST_CAM);
+    A(wd[0] >= 0 && wd[7] >= 0 && wd[2] < 0);
+
+    // written and renamed chunks, other files ignored
+    snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 8000);
+    test_file(0, name, false);
+    snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 12000);
+    test_file(7, name, true);
+    test_file(0, "index.txt", false);
+    snprintf(name, sizeof(name), "%lx.ts.part", TEST_MS0 + 16000);
+    test_file(0, name, false);
+    A(test_events(2) == 2);
+    A(ci.len == 4);
+    test_chunk(2, TEST_MS0 + 8000, 0);
+    test_chunk(3, TEST_MS0 + 12000, 7);
+
+    // chunk already known from master, late chunk of other server inserted in order
+    snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 4000);
+    test_file(0, name, false);
+    snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 6000);
+    test_file(7, name, true);
+    A(test_events(2) == 2);
+    A(ci.len == 5);
+    test_chunk(1, TEST_MS0 + 4000, 0);
+    test_chunk(2, TEST_MS0 + 6000, 7);
+    test_chunk(4, TEST_MS0 + 12000, 7);
+
+    // burst larger than one read
+    for (int i = 0; i < 300; i++)
+    {
+        snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 100000 + i * 4000);
+        test_file(i & 1 ? 7 : 0, name, i % 3 == 0);
+    }
+    A(test_events(300) == 300);
+    A(ci.len == 305);
+    for (int i = 0; i < 300; i++)
+        test_chunk(5 + i, TEST_MS0 + 100000 + i * 4000, i & 1 ? 7 : 0);
+    A(chunk_find(&ci, TEST_MS0 + 100000 + 150 * 4000 + 1999) == ci.ch + 5 + 150);
+
+    // removed directory unwatched, new server directory watched on rescan
+    snprintf(name, sizeof(name), "rm -rf %s/" SRVF, root, 7);
+    CAZ(system(name));
+    test_events(0);
+    A(wd[7] < 0);
+    test_dir(3);
+    chunk_watch_scan(fd, wd, root, TEST_DAY, TEST_CAM);
+    A(wd[3] >= 0 && wd[7] < 0);
+    snprintf(name, sizeof(name), "%lx.ts", TEST_MS0 + 2000000);
+    test_file(3, name, true);
+    A(test_events(1) == 1);
+    test_chunk(ci.len - 1, TEST_MS0 + 2000000, 3);
+
+    close(fd);
+    chunk_free(&ci);
+    snprintf(name, sizeof(name), "rm -rf %s", root);
+    CAZ(system(name));
+    printf("test_chunk ok\n");
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+// frame addressing and keyframe index on generated TS chunks: make test
+
+#define main jc_player_main
+#include "main.c"
+#undef main
+
+#include "test_stream.h"
+
+#define TEST_MS0 0x18b8fa11000ull
+
+static chunk_t test_ch[] = {
+    {TEST_MS0, 0, 100},          // nominal
+    {TEST_MS0 + 4000, 0, 50},    // short
+    {TEST_MS0 + 6000, 1, 150},   // long
+    {TEST_MS0 + 12000, 1, 0},    // unknown, gap after
+    {TEST_MS0 + 30000, 0, 0},    // unknown, last
+};
+#define TEST_CHUNKS (sizeof(test_ch) / sizeof(test_ch[0]))
+
+static void test_chunk_id(void)
+{
+    chunk_index_t ci = {};
+    chunk_merge(&ci, test_ch, TEST_CHUNKS, 0, NULL);
+    chunk_t *a = ci.ch, *b = a + 1, *c = a + 2, *d = a + 3, *e = a + 4;
+
+    // duration from next chunk
+    A(chunk_id(&ci, a, a->ms) == 0);
+    A(chunk_id(&ci, a, a->ms + 3999) == 99);
+    A(chunk_id(&ci, a, b->ms) == 99);
+    A(chunk_id(&ci, b, b->ms + 1000) == 25);
+    A(chunk_id(&ci, b, b->ms + 1999) == 49);
+    A(chunk_id(&ci, c, c->ms + 5999) == 149);
+
+    // nominal duration before gap and at the end, outside chunk
+    A(chunk_id(&ci, d, d->ms + 2000) == 50);
+    A(chunk_id(&ci, d, d->ms + 4001) == 0);
+    A(chunk_id(&ci, e, e->ms + 2000) == 50);
+    A(chunk_id(&ci, a, a->ms - 1) == 0);
+
+    chunk_free(&ci);
+}
+
+static void test_step(uint32_t *ck, uint64_t *ms, uint32_t *id, int dir, uint32_t skip, uint32_t to_ck, uint32_t to_id)
+{
+    A(stream_frame_step(ck, ms, id, dir, skip));
+    A(*ck == to_ck && *ms == stream.chi.ch[to_ck].ms && *id == to_id);
+}
+
+static void test_frame_step(void)
+{
+    uint32_t ck = 0, id, n;
+    uint64_t ms;
+    chunk_merge(&stream.chi, test_ch, TEST_CHUNKS, 0, NULL);
+    chunk_t *ch = stream.chi.ch;
+
+    // chunk boundaries by learned frame counts
+    ms = ch[1].ms, id = 49;
+    test_step(&ck, &ms, &id, 1, 1, 2, 0);
+    ms = ch[1].ms, id = 48;
+    test_step(&ck, &ms, &id, 1, 4, 2, 0);
+    test_step(&ck, &ms, &id, -1, 1, 1, 49);
+    ms = ch[3].ms, id = 0;
+    test_step(&ck, &ms, &id, -1, 4, 2, 148);
+    ms = ch[1].ms, id = 0;
+    test_step(&ck, &ms, &id, -1, 1, 0, 99);
+    ms = ch[4].ms, id = 0;
+    test_step(&ck, &ms, &id, -1, 1, 3, 99);
+    ms = ch[4].ms, id = 95;
+    test_step(&ck, &ms, &id, 1, 4, 4, 99);
+
+    // ends of index
+    A(!stream_frame_step(&ck, &ms, &id, 1, 1));
+    ms = ch[4].ms, id = 96;
+    A(!stream_frame_step(&ck, &ms, &id, 1, 4));
+    ms = ch[0].ms, id = 0;
+    A(!stream_frame_step(&ck, &ms, &id, -1, 1));
+    A(ck == 0 && ms == ch[0].ms && id == 0);
+
+    // every frame once in both directions
+    for (n = 0; stream_frame_step(&ck, &ms, &id, 1, 1); n++)
+        ;
+    A(n == 100 + 50 + 150 + 100 + 100 - 1 && ck == TEST_CHUNKS - 1 && id == 99);
+    for (n = 0; stream_frame_step(&ck, &ms, &id, -1, 1); n++)
+        ;
+    A(n == 100 + 50 + 150 + 100 + 100 - 1 && ck == 0 && id == 0);
+
+    // chunk not in index
+    ms = TEST_MS0 - 1;
+    A(!stream_frame_step(&ck, &ms, &id, 1, 1));
+}
+
+static void test_gop(uint64_t ms, uint32_t frames, uint32_t gopn, int64_t pts0, bool rai)
+{
+    static decoder_t d;
+    static uint8_t b[TEST_TS_SIZE(STREAM_FRAMES_MAX + 50, 3000)];
+    AVPacket packet = {};
+    chunk_t ch = {ms, 0, 0};
+
+    A(sizeof(b) >= TEST_TS_SIZE(frames, 3000));
+    chunk_merge(&stream.chi, &ch, 1, 0, NULL);
+    d.map = (bd_t){b, test_ts_chunk(b, frames, gopn, 3000, pts0, rai), 0};
+    uint32_t n = FFMIN(frames, STREAM_FRAMES_MAX), gopnext = d.gopnext;
+    gop_t *gop = stream_gop(&d, ms);
+
+    A(gop->ms == ms && gop->frames == n && gop->len == (n + gopn - 1) / gopn);
+    for (uint32_t i = 0; i < gop->len; i++)
+    {
+        // demux restarts at keyframe packet
+        bd_t bd = {b, d.map.blen, gop->key[i].pos};
+        A(gop->key[i].id == i * gopn);
+        CAZ(ts_read_packet(&bd, &packet));
+        A(packet.pos == gop->key[i].pos && (packet.flags & AV_PKT_FLAG_KEY));
+        A(packet.pts == ((pts0 + (int64_t)gop->key[i].id * TEST_PTS_STEP) & ((1ll << 33) - 1)));
+        av_packet_unref(&packet);
+    }
+    for (uint32_t i = 0; i < n; i++)
+        A(gop->msec[i] == i * STREAM_FPS_MSEC);
+
+    // frame count learned into index, cached index not demuxed again
+    A(chunk_get(&stream.chi, ms)->frames == n);
+    A(stream_gop(&d, ms) == gop && d.gopnext == gopnext + 1);
+}
+
+static void test_cache(void)
+{
+    // finished day index written and read back from data path, day removal drops it
+    char fn[256 + 64];
+    chunk_index_t ci = {};
+    int f;
+
+    strcpy(stream.path, "/tmp/test_stream-XXXXXX");
+    A(mkdtemp(stream.path));
+    snprintf(fn, sizeof(fn), "mkdir -p %s/" SRVF "/2023-11-02/" CAMF, stream.path, 0, 3);
+    CAZ(system(fn));
+    snprintf(fn, sizeof(fn), "%s/" SRVF "/2023-11-02/" CAMF "/%lx.ts", stream.path, 0, 3, test_ch[TEST_CHUNKS - 1].ms);
+    CAVZP(f, open(fn, O_WRONLY | O_CREAT, 0644));
+    close(f);
+
+    chunk_reserve(&ci, TEST_CHUNKS);
+    memcpy(ci.ch, test_ch, sizeof(test_ch));
+    ci.len = TEST_CHUNKS;
+    chunk_cache_save(&ci, "2023-11-02", 3);
+    snprintf(fn, sizeof(fn), CHUNK_CACHE_FILE, stream.path, "2023-11-02", 3);
+    struct stat st;
+    CAZ(stat(fn, &st));
+    A(st.st_size == CHUNK_CACHE_HEAD + CHUNK_CACHE_ENTRY * TEST_CHUNKS);
+
+    ci.len = 0;
+    A(chunk_cache_load(&ci, "2023-11-02", 3));
+    A(ci.len == TEST_CHUNKS);
+    for (uint32_t i = 0; i < TEST_CHUNKS; i++)
+        A(ci.ch[i].ms == test_ch[i].ms && ci.ch[i].srvid == test_ch[i].srvid && ci.ch[i].frames == test_ch[i].frames);
+
+    chunk_cache_remove("2023-11-02");
+    ci.len = 0;
+    A(!chunk_cache_load(&ci, "2023-11-02", 3) && !ci.len);
+
+    chunk_free(&ci);
+    snprintf(fn, sizeof(fn), "rm -rf %s", stream.path);
+    CAZ(system(fn));
+}
+
+static void test_convert(void)
+{
+    // software decoder in other pixel format: own buffer, sampled into pooled dumb buffer as NV12
+    static decoder_t d;
+    swframe_t *sf;
+
+    CAZ(pthread_mutex_init(&stream.swdec_mutex, NULL));
+    CAVNZ(d.ctx, avcodec_alloc_context3(NULL));
+    CAVNZ(d.frame, av_frame_alloc());
+    d.frame->width = 64;
+    d.frame->height = 32;
+    d.frame->format = AV_PIX_FMT_YUV422P10LE;
+    CAZ(av_frame_get_buffer(d.frame, 0));
+    for (int y = 0; y < 32; y++)
+        for (int x = 0; x < 64; x++)
+        {
+            ((uint16_t *)(d.frame->data[0] + y * d.frame->linesize[0]))[x] = x << 4;
+            if (x < 32)
+            {
+                ((uint16_t *)(d.frame->data[1] + y * d.frame->linesize[1]))[x] = y << 4;
+                ((uint16_t *)(d.frame->data[2] + y * d.frame->linesize[2]))[x] = 1020 - (x << 4);
+            }
+        }
+
+    swdec_nv12(&d);
+    A(d.frame->format == AV_PIX_FMT_YUV420P && d.frame->width == 64 && d.frame->height == 32);
+    sf = swdec_frame(d.frame);
+    for (int y = 0; y < 32; y++)
+        for (int x = 0; x < 64; x++)
+            A(sf->map[y * sf->pitch + x] == x << 2);
+    for (int y = 0; y < 16; y++)
+        for (int x = 0; x < 32; x++)
+        {
+            uint8_t *uv = sf->map + sf->pitch * (sf->height + y) + 2 * x;
+            A(uv[0] == 2 * y << 2 && uv[1] == 255 - (x << 2));
+        }
+
+    // dumb buffers destroyed once pool and frames are gone
+    av_frame_free(&d.frame);
+    av_frame_free(&d.convert);
+    avcodec_free_context(&d.ctx);
+    av_buffer_pool_uninit(&stream.swdec_pool);
+}
+
+int main(int argc, char **argv)
+{
+    test_stream_setup(AV_CODEC_ID_H264);
+    test_chunk_id();
+    test_frame_step();
+    test_cache();
+    test_convert();
+
+    // random access flag or IDR NAL, PTS wrap, more frames than index holds
+    test_gop(TEST_MS0 + 100000, 100, 25, 900000, true);
+    test_gop(TEST_MS0 + 104000, 37, 12, (1ll << 33) - 10 * TEST_PTS_STEP, false);
+    test_gop(TEST_MS0 + 108000, 1, 1, 0, false);
+    test_gop(TEST_MS0 + 112000, STREAM_FRAMES_MAX + 45, 50, 123456, false);
+    stream.codecpar->codec_id = AV_CODEC_ID_HEVC;
+    test_gop(TEST_MS0 + 124000, 60, 30, 5000, false);
+
+    chunk_free(&stream.chi);
+    printf("test_stream ok\n");
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+SPDX-License-Identifier: MPL-2.0
+SPDX-FileCopyrightText: 2023 Martin Cerveny <martin@c-home.cz>
+*/
+
+// stream internals without display for tests and benchmarks, included after main.c
+
+#ifndef _TEST_STREAM_H_
+#define _TEST_STREAM_H_
+
+#define TEST_PID 0x100
+#define TEST_PTS_STEP (90 * STREAM_FPS_MSEC)                                // 90 kHz
+#define TEST_TS_SIZE(frames, bytes) ((frames) * ((bytes) / 180 + 4) * TS_PACKET) // chunk buffer bound
+#define TEST_H264_BYTES(mbw, mbh) ((mbw) * (mbh) * 386 + 64)                      // IDR access unit bound
+
+// +++ DISPLAY
+
+void disp_setup(char *cmd_param, plane_t **vi, plane_t **ui, uint32_t *crtc_width, uint32_t *crtc_height) {}
+void disp_cleanup(void) {}
+uint32_t disp_wait(uint32_t sequence, uint64_t *ns) { return sequence; }
+uint64_t disp_vblank_ns(void) { return STREAM_FPS_NSEC / 2; }
+void disp_plane_setup(plane_t *plane, uint32_t format, uint32_t width, uint32_t height, uint32_t pitches[DISP_MAX_PLANES], uint32_t offsets[DISP_MAX_PLANES], uint32_t zpos) {}
+void disp_plane_scale(plane_t *plane, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t fb_x, uint32_t fb_y, uint32_t fb_width, uint32_t fb_height) {}
+void disp_plane_show_pic(plane_t *plane, uint32_t prime_fd) {}
+void disp_plane_drop_pic(plane_t *plane, uint32_t prime_fd) {}
+void disp_plane_reserve(plane_t *plane, uint32_t frames) {}
+void disp_plane_hide(plane_t *plane) {}
+void disp_plane_release(plane_t *plane, disp_release_t release, void *data) {}
+void disp_plane_flush(plane_t *plane) {}
+
+void disp_plane_create(plane_t *plane, uint32_t format, uint32_t width, uint32_t height, uint32_t bpp, int *prime_fd, uint32_t *pitch, uint32_t *size, uint32_t **map)
+{
+    // dumb buffer in memory, never exported
+    uint32_t p = FFALIGN(width * bpp / 8, 64);
+
+    if (pitch)
+        *pitch = p;
+    if (size)
+        *size = p * height;
+    if (prime_fd)
+        *prime_fd = -1;
+    if (map)
+        CAVNZ(*map, aligned_alloc(64, p * height));
+}
+
+void disp_plane_destroy(plane_t *plane, int prime_fd, uint32_t size, uint32_t *map)
+{
+    free(map);
+}
+
+// +++ STREAM
+
+static void test_stream_setup(enum AVCodecID codec_id)
+{
+    // what stream_setup probes from the first chunk
+    CAZ(pthread_mutex_init(&stream.decoder_mutex, NULL));
+    CAZ(pthread_cond_init(&stream.decoder_cond, NULL));
+    CAZ(pthread_cond_init(&stream.loader_cond, NULL));
+    CAVNZ(stream.codecpar, avcodec_parameters_alloc());
+    stream.codecpar->codec_id = codec_id;
+    stream.video_pid = TEST_PID;
+    CAVNZ(stream.decode_pool, av_buffer_pool_init(STREAM_PES_MAX + AV_INPUT_BUFFER_PADDING_SIZE, NULL));
+}
+
+static uint8_t *test_ts_packet(uint8_t *o, uint32_t pid, bool pusi, bool rai, const uint8_t **p, size_t *len, uint8_t *cc)
+{
+    // one TS packet of PES bytes, adaptation field stuffing for short tail and random access flag
+    size_t n = FFMIN(*len, TS_PACKET - 4);
+    if (rai)
+        n = FFMIN(n, TS_PACKET - 6);
+    bool af = rai || n < TS_PACKET - 4;
+
+    o[0] = 0x47;
+    o[1] = (pusi ? 0x40 : 0) | pid >> 8;
+    o[2] = pid;
+    o[3] = (af ? 0x30 : 0x10) | ((*cc)++ & 0x0f);
+    uint8_t *q = o + 4;
+    if (af)
+    {
+        size_t afl = TS_PACKET - 4 - n - 1;
+        q[0] = afl;
+        if (afl)
+        {
+            q[1] = rai ? 0x40 : 0;
+            memset(q + 2, 0xff, afl - 1);
+        }
+        q += 1 + afl;
+    }
+    memcpy(q, *p, n);
+    *p += n;
+    *len -= n;
+    return o + TS_PACKET;
+}
+
+static uint8_t *test_ts_pes(uint8_t *o, const uint8_t *es, size_t len, int64_t pts, bool key, bool rai, uint8_t *cc, uint8_t *occ)
+{
+    // access unit in one PES, other pid packet (PAT/PMT place) before keyframe
+    static uint8_t pes[STREAM_PES_MAX];
+    uint8_t *p = pes;
+
+    if (key)
+    {
+        // skipped by demuxer
+        const uint8_t *f = pes;
+        size_t flen = TS_PACKET - 4;
+        memset(pes, 0xff, flen);
+        o = test_ts_packet(o, 0, true, false, &f, &flen, occ);
+    }
+
+    pts &= (1ll << 33) - 1;
+    *p++ = 0, *p++ = 0, *p++ = 1, *p++ = 0xe0, *p++ = 0, *p++ = 0, *p++ = 0x80, *p++ = 0x80, *p++ = 5;
+    *p++ = 0x21 | ((pts >> 29) & 0x0e);
+    *p++ = pts >> 22;
+    *p++ = 0x01 | ((pts >> 14) & 0xfe);
+    *p++ = pts >> 7;
+    *p++ = 0x01 | ((pts << 1) & 0xfe);
+    memcpy(p, es, len);
+    p += len;
+
+    const uint8_t *f = pes;
+    size_t flen = p - pes;
+    o = test_ts_packet(o, TEST_PID, true, rai, &f, &flen, cc);
+    while (flen)
+        o = test_ts_packet(o, TEST_PID, false, false, &f, &flen, cc);
+    return o;
+}
+
+static size_t test_ts_chunk(uint8_t *b, uint32_t frames, uint32_t gop, uint32_t bytes, int64_t pts0, bool rai)
+{
+    // H.264 (HEVC by stream codec) access unit per frame, IDR every gop frames, not decodable
+    static uint8_t es[STREAM_PES_MAX];
+    uint8_t *o = b, cc = 0, occ = 0;
+
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        bool key = !(i % gop);
+        size_t len = key ? bytes : bytes / 4 + 1;
+        uint8_t *p = es;
+
+        *p++ = 0, *p++ = 0, *p++ = 0, *p++ = 1;
+        if (stream.codecpar->codec_id == AV_CODEC_ID_HEVC)
+            *p++ = (key ? 19 : 1) << 1, *p++ = 1; // IDR_W_RADL, TRAIL_R
+        else
+            *p++ = key ? 0x65 : 0x41; // IDR, non-IDR slice
+        memset(p, 0xaa, len);
+        p += len;
+        o = test_ts_pes(o, es, p - es, pts0 + (int64_t)i * TEST_PTS_STEP, key, key && rai, &cc, &occ);
+    }
+    return o - b;
+}
+
+// +++ H.264
+
+typedef struct
+{
+    uint8_t *p;
+    uint32_t acc, n; // bits not yet written
+} test_bits_t;
+
+static void test_bits(test_bits_t *bw, uint32_t v, int n)
+{
+    // msb first
+    while (n--)
+    {
+        bw->acc = bw->acc << 1 | ((v >> n) & 1);
+        if (++bw->n == 8)
+        {
+            *bw->p++ = bw->acc;
+            bw->acc = bw->n = 0;
+        }
+    }
+}
+
+static void test_ue(test_bits_t *bw, uint32_t v)
+{
+    // Exp-Golomb, se(0) too
+    int n = 32 - __builtin_clz(v + 1);
+    test_bits(bw, 0, n - 1);
+    test_bits(bw, v + 1, n);
+}
+
+static void test_align(test_bits_t *bw, bool stop)
+{
+    if (stop)
+        test_bits(bw, 1, 1); // rbsp_stop_one_bit
+    while (bw->n)
+        test_bits(bw, 0, 1);
+}
+
+static uint8_t *test_nal(uint8_t *o, const uint8_t *rbsp, const uint8_t *e)
+{
+    // start code, emulation prevention
+    int zeros = 0;
+
+    *o++ = 0, *o++ = 0, *o++ = 0, *o++ = 1;
+    for (; rbsp < e; rbsp++)
+    {
+        if (zeros == 2 && *rbsp <= 3)
+        {
+            *o++ = 3;
+            zeros = 0;
+        }
+        zeros = *rbsp ? 0 : zeros + 1;
+        *o++ = *rbsp;
+    }
+    return o;
+}
+
+static size_t test_h264_chunk(uint8_t *b, uint32_t frames, uint32_t gop, uint32_t mbw, uint32_t mbh)
+{
+    // decodable H.264 of mbw x mbh macroblocks: SPS, PPS and IDR of PCM macroblocks every gop frames, P of skipped ones between
+    static uint8_t es[STREAM_PES_MAX], rbsp[STREAM_PES_MAX];
+    uint8_t *o = b, cc = 0, occ = 0;
+
+    A(TEST_H264_BYTES(mbw, mbh) <= STREAM_PES_MAX);
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        bool key = !(i % gop);
+        uint8_t *p = es;
+        test_bits_t bw = {rbsp};
+
+        if (key)
+        {
+            // baseline, 4 bit frame_num, POC type 2 (output in decode order), one reference frame
+            test_bits(&bw, 0x67, 8);
+            test_bits(&bw, 66, 8);
+            test_bits(&bw, 0xc0, 8); // constraint_set0/1
+            test_bits(&bw, 40, 8);
+            test_ue(&bw, 0); // sps id
+            test_ue(&bw, 0); // log2_max_frame_num - 4
+            test_ue(&bw, 2); // pic_order_cnt_type
+            test_ue(&bw, 1); // max_num_ref_frames
+            test_bits(&bw, 0, 1);
+            test_ue(&bw, mbw - 1);
+            test_ue(&bw, mbh - 1);
+            test_bits(&bw, 0xc, 4); // frame_mbs_only, direct_8x8_inference, no cropping, no VUI
+            test_align(&bw, true);
+            p = test_nal(p, rbsp, bw.p);
+
+            // CAVLC, deblocking control present
+            bw = (test_bits_t){rbsp};
+            test_bits(&bw, 0x68, 8);
+            test_ue(&bw, 0); // pps id
+            test_ue(&bw, 0); // sps id
+            test_bits(&bw, 0, 2);
+            test_ue(&bw, 0); // slice groups
+            test_ue(&bw, 0); // l0 refs - 1
+            test_ue(&bw, 0); // l1 refs - 1
+            test_bits(&bw, 0, 3); // weighted prediction
+            test_ue(&bw, 0); // qp, qs, chroma qp offset
+            test_ue(&bw, 0);
+            test_ue(&bw, 0);
+            test_bits(&bw, 0x4, 3);
+            test_align(&bw, true);
+            p = test_nal(p, rbsp, bw.p);
+
+            // I slice, every macroblock I_PCM with luma level of its position
+            bw = (test_bits_t){rbsp};
+            test_bits(&bw, 0x65, 8);
+            test_ue(&bw, 0); // first_mb_in_slice
+            test_ue(&bw, 7);
+            test_ue(&bw, 0); // pps id
+            test_bits(&bw, 0, 4); // frame_num
+            test_ue(&bw, i / gop & 1); // idr_pic_id
+            test_bits(&bw, 0, 2); // no_output_of_prior_pics, long_term_reference
+            test_ue(&bw, 0); // slice_qp_delta
+            test_ue(&bw, 1); // deblocking off
+            for (uint32_t mb = 0; mb < mbw * mbh; mb++)
+            {
+                test_ue(&bw, 25);
+                test_align(&bw, false);
+                memset(bw.p, 16 + (mb * 7 + i) % 220, 256);
+                memset(bw.p + 256, 128, 128);
+                bw.p += 384;
+            }
+        }
+        else
+        {
+            // P slice, all macroblocks skipped
+            test_bits(&bw, 0x41, 8);
+            test_ue(&bw, 0); // first_mb_in_slice
+            test_ue(&bw, 5);
+            test_ue(&bw, 0); // pps id
+            test_bits(&bw, i % gop, 4); // frame_num, wraps
+            test_bits(&bw, 0, 3); // no ref override, no list modification, sliding window
+            test_ue(&bw, 0); // slice_qp_delta
+            test_ue(&bw, 1); // deblocking off
+            test_ue(&bw, mbw * mbh); // mb_skip_run
+        }
+        test_align(&bw, true);
+        p = test_nal(p, rbsp, bw.p);
+        o = test_ts_pes(o, es, p - es, (int64_t)i * TEST_PTS_STEP, key, key, &cc, &occ);
+    }
+    return o - b;
+}
+
+#endif